@@ -2,15 +2,47 @@
  * Voice Satellite - ESP32-S3 Firmware
  *
  * Push-to-talk voice assistant satellite.
- * Records audio from INMP441 mic while button is held,
- * sends WAV to Raspberry Pi server via HTTP POST,
+ * Records audio from INMP441 mic while button is held (or after an
+ * optional wake word),
+ * streams it to the Raspberry Pi server as it is captured (persistent
+ * WebSocket, or HTTP POST with chunked body),
  * receives processed audio response and plays through PCM5102A DAC.
  */
 
 #include <Arduino.h>
 #include <WiFi.h>
+#include <ESPmDNS.h>
+#include <mdns.h>
 #include <HTTPClient.h>
-#include <driver/i2s.h>
+#include <WebSocketsClient.h>
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#if !__has_include(<driver/i2s_std.h>)
+#error "The I2S channel driver needs Arduino-ESP32 3.x (ESP-IDF 5), see platformio.ini"
+#endif
+#include <driver/i2s_std.h>
+#include <esp_timer.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <freertos/timers.h>
+#include <atomic>
+
+#if __has_include(<esp_dsp.h>)
+#include <esp_dsp.h>
+#define HAVE_ESP_DSP 1
+#endif
+
+#if __has_include(<esp_wn_iface.h>)
+#include <esp_wn_iface.h>
+#include <esp_wn_models.h>
+#include <model_path.h>
+#endif
+
+#if __has_include(<esp_aec.h>)
+#include <esp_aec.h>
+#define HAVE_ESP_AEC 1
+#endif
 
 // ============================================================
 // CONFIGURATION - Update these for your setup
@@ -20,9 +52,15 @@
 const char* WIFI_SSID     = "YOUR_WIFI_SSID";
 const char* WIFI_PASSWORD = "YOUR_WIFI_PASSWORD";
 
-// Processing hub server address (Debian server / RPi / any machine on LAN)
+// Processing hub server address (Debian server / RPi / any machine on LAN).
+// With HUB_DISCOVERY, hubs advertising themselves over mDNS are used too
+// and this is only one of the candidates.
 const char* SERVER_URL = "http://192.168.1.100:8000/api/voice";
 
+// Name this satellite reports to the hub (e.g. "kitchen"). Leave empty to
+// use "sat-" + the WiFi MAC, which is unique and survives reflashing.
+const char* SATELLITE_ID = "";
+
 // ============================================================
 // PIN DEFINITIONS
 // ============================================================
@@ -39,6 +77,7 @@ const char* SERVER_URL = "http://192.168.1.100:8000/api/voice";
 
 // Controls
 #define BUTTON_PIN      0   // Push-to-Talk button (active LOW with internal pull-up)
+#define BUTTON_DEBOUNCE_MS  20  // Level must hold this long after the last edge
 #define LED_PIN         2   // Status LED (built-in on most boards)
 
 // ============================================================
@@ -53,7 +92,40 @@ const char* SERVER_URL = "http://192.168.1.100:8000/api/voice";
 // I2S read buffer (per DMA read call)
 #define I2S_READ_BUF_SIZE   1024
 
-// Maximum recording: 15 seconds (uses PSRAM if available)
+// I2S DMA geometry, per port: DESC_NUM buffers of FRAME_NUM samples each.
+// A frame is one sample (mono, 16-bit), so 256 frames = 16 ms at 16 kHz.
+// The driver interrupts once per buffer: smaller buffers mean lower mic
+// and speaker latency but more wakeups, more buffers mean more slack
+// before the task falls behind (DESC_NUM * FRAME_NUM samples in flight).
+// Keep MIC_DMA_FRAME_NUM * BYTES_PER_SAMPLE a divisor of I2S_READ_BUF_SIZE
+// so one read drains whole buffers.
+#define MIC_DMA_DESC_NUM    8
+#define MIC_DMA_FRAME_NUM   256
+#define DAC_DMA_DESC_NUM    8
+#define DAC_DMA_FRAME_NUM   256
+
+// Capture ring buffer between the I2S capture task and the network side
+// 65536 bytes = ~2 seconds of audio the network may fall behind by
+// (power of two, and a multiple of I2S_READ_BUF_SIZE so frames never wrap)
+#define CAPTURE_RING_SIZE   65536
+
+// Playback jitter buffer between the network and the DAC
+// 65536 bytes = ~2 seconds of reply audio in flight (power of two)
+#define PLAYBACK_RING_SIZE      65536
+#define PLAYBACK_BLOCK_SIZE     1024        // Bytes per DAC write / socket read
+#define PLAYBACK_PREBUFFER_MS   300         // Audio buffered before the DAC starts
+#define PLAYBACK_PREBUFFER_BYTES(rate) ((rate) * BYTES_PER_SAMPLE * PLAYBACK_PREBUFFER_MS / 1000)
+
+// Reply sample rates the DAC can be clocked at, sent to the hub as
+// X-Playback-Rates. The hub sends TTS audio at the voice's native rate when
+// it's listed (Piper voices are 16 or 22.05 kHz), so neither side resamples;
+// otherwise at SAMPLE_RATE. The mic always records at SAMPLE_RATE.
+#define PLAYBACK_RATES          "16000,22050,24000"
+#define PLAYBACK_RATES_AEC      "16000"     // With the AEC on its speaker reference must match the mic
+
+// The streaming transports send audio out of the capture ring as it's
+// recorded, so an utterance can be any length. Only TRANSPORT_HTTP_BUFFERED
+// holds the whole recording and is capped (uses PSRAM if available):
 // 16000 samples/s * 2 bytes/sample * 15s = 480,000 bytes (~469 KB)
 #define MAX_RECORDING_SECS  15
 #define MAX_AUDIO_BYTES     (SAMPLE_RATE * BYTES_PER_SAMPLE * MAX_RECORDING_SECS)
@@ -61,88 +133,581 @@ const char* SERVER_URL = "http://192.168.1.100:8000/api/voice";
 // WAV header is 44 bytes
 #define WAV_HEADER_SIZE     44
 
+// Data size written into the header of a streamed WAV (length not known yet)
+#define WAV_STREAMING_SIZE  0xFFFFFFFF
+
+// ============================================================
+// NETWORK CONFIGURATION
+// ============================================================
+
+// How audio gets to the server:
+// TRANSPORT_WEBSOCKET     - persistent WebSocket to WS_PATH, PCM frames are
+//                           sent while the button is held (no per-turn handshake)
+// TRANSPORT_HTTP_STREAM   - one HTTP POST per turn, body streamed with chunked
+//                           transfer encoding while the button is held
+// TRANSPORT_HTTP_BUFFERED - buffer the whole recording and POST it after release
+#define TRANSPORT_HTTP_BUFFERED 0
+#define TRANSPORT_HTTP_STREAM   1
+#define TRANSPORT_WEBSOCKET     2
+#define TRANSPORT               TRANSPORT_WEBSOCKET
+
+// WebSocket endpoint on the same host/port as SERVER_URL
+#define WS_PATH             "/ws/voice"
+#define WS_RECONNECT_MS     2000        // Retry interval while the hub is unreachable
+
+// How long to wait for the server's reply (AI processing takes time)
+#define HTTP_TIMEOUT_MS     30000
+
+// Connection manager: WiFi is retried in the background while it's down,
+// the radio only uses modem sleep between turns, and the HTTP transports
+// keep a TCP connection to the hub open so a turn needs no handshake.
+#define WIFI_RECONNECT_MS       10000   // Retry interval while WiFi is down
+#define WIFI_IDLE_MODEM_SLEEP   1       // Modem sleep between turns (saves power, adds DTIM latency)
+#define HUB_CONNECT_TIMEOUT_MS  3000
+
+// Hub discovery: find hubs via mDNS (_voicehub._tcp), probe their
+// /api/health and use the one with the lowest RTT + load score. A hub
+// that fails a turn or drops the WebSocket is swapped for the next best.
+#define HUB_DISCOVERY           1
+#define HUB_MDNS_SERVICE        "voicehub"
+#define HUB_MAX                 4
+#define HUB_PROBE_MS            60000   // Re-probe interval while idle
+#define HUB_MDNS_TIMEOUT_MS     250     // mDNS query wait (blocks loop())
+#define HUB_PROBE_TIMEOUT_MS    500     // Per /api/health probe (blocks loop())
+#define HUB_LOAD_PENALTY_MS     400     // Score added per active or queued turn on a hub
+#define HUB_FAILURE_PENALTY_MS  5000    // ... per recent failure
+#define HUB_SWITCH_MARGIN_MS    50      // Only move when another hub is this much better
+#define HUB_FAILOVER_MS         6000    // WebSocket down this long counts as a failure
+
+// ============================================================
+// AUDIO FRONT END
+// ============================================================
+
+// Per-frame DSP on the capture task, in place on each frame before it's
+// committed: DC blocker, high-pass biquad, then AGC. Uses the ESP-DSP
+// vector kernels on the S3 when the library is available.
+#define FRONTEND_ENABLED        1
+
+#define FRONTEND_DC_POLE        0.995f  // DC blocker pole (~13 Hz corner at 16 kHz)
+#define FRONTEND_HPF_HZ         100.0f  // Cuts rumble and handling noise below the voice band
+#define FRONTEND_HPF_Q          0.707f
+
+#define AGC_ENABLED             1
+#define AGC_TARGET_RMS          3000.0f // Speech level to aim for (~-21 dBFS)
+#define AGC_MIN_GAIN            0.5f
+#define AGC_MAX_GAIN            16.0f   // INMP441 at arm's length needs ~20 dB
+#define AGC_GATE_RMS            30.0f   // Quieter frames (pre-gain) leave the gain alone
+#define AGC_ATTACK              0.3f    // Per-frame step toward a lower gain
+#define AGC_RELEASE             0.02f   // Per-frame step toward a higher gain
+
+// ============================================================
+// VOICE ACTIVITY DETECTION
+// ============================================================
+
+// Energy / zero-crossing VAD over each capture frame (512 samples = 32 ms).
+// Leading and trailing silence is not sent, and long pauses are shortened.
+#define VAD_ENABLED             1
+
+// Optionally end the utterance on its own once the speaker goes quiet
+// (0 = only the button ends it)
+#define VAD_AUTO_END_MS         0
+
+#define VAD_PREROLL_MS          200     // Audio kept before the detected speech onset
+#define VAD_TAIL_MS             250     // Audio kept after the last speech frame
+#define VAD_ONSET_FRAMES        2       // Consecutive speech frames that count as speech
+#define VAD_SPEECH_RATIO        3.0f    // Frame RMS over noise floor for voiced speech
+#define VAD_FRICATIVE_RATIO     1.8f    // ... for unvoiced speech (s, f, sh), with ...
+#define VAD_FRICATIVE_ZCR       0.25f   // ... zero crossings per sample above this
+#define VAD_MIN_RMS             80.0f   // Never speech below this level (16-bit units)
+#define VAD_INITIAL_NOISE       150.0f  // Noise floor estimate before the first frame
+
+#define VAD_FRAME_MS            (I2S_READ_BUF_SIZE / BYTES_PER_SAMPLE * 1000 / SAMPLE_RATE)
+#define VAD_PREROLL_BYTES       (VAD_PREROLL_MS / VAD_FRAME_MS * I2S_READ_BUF_SIZE)
+#define VAD_TAIL_BYTES          (VAD_TAIL_MS / VAD_FRAME_MS * I2S_READ_BUF_SIZE)
+
+// ============================================================
+// WAKE WORD
+// ============================================================
+
+// Always-listening wake word (ESP-SR WakeNet) alongside the button. Needs
+// the ESP-SR model partition: board_build.partitions = esp_sr_16.csv and
+// the WakeNet model flashed to it (see CLAUDE.md).
+#define WAKE_WORD_ENABLED       0
+
+#define WAKE_WORD_MODEL         "hiesp"   // Matched against the WakeNet model names ("wn9_hiesp")
+#define WAKE_DET_MODE           DET_MODE_95
+#define WAKE_PREROLL_MS         300     // Audio kept from just before the wake word fires
+#define WAKE_END_SILENCE_MS     800     // Wake turns end on this much silence after speech
+#define WAKE_LISTEN_TIMEOUT_MS  4000    // ... or if nothing is said at all
+
+#define WAKE_PREROLL_BYTES      (WAKE_PREROLL_MS / VAD_FRAME_MS * I2S_READ_BUF_SIZE)
+
+#if WAKE_WORD_ENABLED && !VAD_ENABLED
+#error "Wake-word turns end on silence, WAKE_WORD_ENABLED needs VAD_ENABLED"
+#endif
+
+// ============================================================
+// BARGE-IN
+// ============================================================
+
+// A button press or the wake word while a reply plays (or is still being
+// worked on) stops the speaker at once and starts the next turn. The mic
+// keeps capturing during playback on its own I2S port; with ESP-SR's AEC
+// (esp_aec.h) the speaker signal is subtracted from it, which is what lets
+// WakeNet hear the wake word over the reply. Without AEC only the button
+// interrupts.
+#define BARGE_IN_ENABLED        1
+#define BARGE_IN_AEC            1
+
+#define AEC_FILTER_LENGTH       4       // Echo tail the AEC models, in 16 ms frames (4 is ESP-SR's S3 default)
+#define ECHO_REF_RING_SIZE      16384   // Speaker reference waiting for the mic, ~0.5 s (power of two)
+
+#if BARGE_IN_ENABLED && BARGE_IN_AEC && defined(HAVE_ESP_AEC)
+#define ECHO_CANCEL 1
+#else
+#define ECHO_CANCEL 0
+#endif
+
+// ============================================================
+// UPLINK CODEC
+// ============================================================
+
+// Codec for audio sent to the server:
+// CODEC_PCM16     - raw 16-bit PCM, 32 KB/s
+// CODEC_IMA_ADPCM - 4-bit IMA-ADPCM in standard WAV blocks, ~8 KB/s
+// CODEC_ADAPTIVE  - picked per turn from the measured uplink: PCM, IMA-ADPCM,
+//                   or IMA-ADPCM at 8 kHz (~4 KB/s) for the weakest links
+#define CODEC_PCM16         0
+#define CODEC_IMA_ADPCM     1
+#define CODEC_ADAPTIVE      2
+#define UPLINK_CODEC        CODEC_ADAPTIVE
+
+#define ADPCM_BLOCK_SIZE        256     // WAV block align (bytes per block, mono)
+#define ADPCM_SAMPLES_PER_BLOCK 505     // 1 sample in the block header + 2 per data byte
+#define ADPCM_WAV_HEADER_SIZE   60      // RIFF + 20-byte fmt + fact + data chunk headers
+
+// CODEC_ADAPTIVE: the best format whose upload left after release fits
+// UPLINK_BUDGET_MS at the throughput measured on earlier turns. Streamed
+// uploads only fall behind by what the link can't carry, the buffered
+// POST sends it all after release. Until a turn has been measured, RSSI
+// rules out the larger formats.
+#define UPLINK_BUDGET_MS        400     // Upload time allowed after release
+#define UPLINK_EXPECTED_SECS    4.0f    // Recording length assumed before the first turn
+#define UPLINK_BACKLOG_MS       150     // A streamed tail longer than this means the link was the limit
+#define UPLINK_PROBE_GAIN       1.25f   // Estimate growth per turn the link kept up, to climb back
+#define UPLINK_RSSI_WEAK        -72     // dBm: below this no raw PCM
+#define UPLINK_RSSI_POOR        -80     // ... and only 8 kHz
+
+// ============================================================
+// EARCONS
+// ============================================================
+
+// Prompt tones and common replies stored in flash (LittleFS on the
+// partition table's "spiffs" partition) and played locally, with no
+// network round trip. The hub publishes the set at /api/earcons; the
+// satellite downloads what it's missing and, over WebSocket, the hub
+// then refers to them by ID instead of sending the audio.
+#define EARCONS_ENABLED     1
+
+#define EARCON_DIR          "/earcons"
+#define EARCON_MAX          32          // Sounds kept in flash
+#define EARCON_ID_LEN       24
+#define EARCON_HASH_LEN     12
+#define EARCON_FS_RESERVE   (64 * 1024) // Flash left free when downloading
+#define EARCON_TIMEOUT_MS   1500        // Connect / read timeout of the list and downloads (they block loop())
+#define EARCON_LISTENING    "listening" // Played when the wake word fires
+#define EARCON_ERROR        "error"     // Played when the hub can't be reached or fails the turn
+
+// ============================================================
+// POWER MANAGEMENT
+// ============================================================
+
+// Idle light sleep: after IDLE_SLEEP_AFTER_MS with no turn, reply or
+// button press, both I2S channels are stopped, WiFi drops to max modem
+// sleep (wakes for every 3rd beacon, the AP buffers in between) and the
+// S3 sits in automatic light sleep. The PTT button wakes it from a GPIO
+// level interrupt and the mic is running again within one DMA buffer.
+// Not entered while the wake word is listening (the mic has to run).
+// Needs CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE (see
+// custom_sdkconfig in platformio.ini), otherwise only modem sleep is used.
+// USB serial drops out while asleep.
+#define IDLE_LIGHT_SLEEP        1
+#define IDLE_SLEEP_AFTER_MS     5000    // Awake this long after activity, so follow-ups start at once
+#define IDLE_POLL_MS            500     // loop() wakeups while asleep: WebSocket, hub probes, WiFi retries
+#define PM_MAX_FREQ_MHZ         240
+#define PM_MIN_FREQ_MHZ         40      // XTAL, the CPU clock while asleep
+
+#if IDLE_LIGHT_SLEEP && !WIFI_IDLE_MODEM_SLEEP
+#error "Light sleep keeps WiFi associated only in modem sleep, IDLE_LIGHT_SLEEP needs WIFI_IDLE_MODEM_SLEEP"
+#endif
+
+// ============================================================
+// METRICS
+// ============================================================
+
+// Health report sent to the hub between turns (it exports them on
+// /metrics): WiFi RSSI, free heap and PSRAM, I2S overruns / underruns,
+// capture drops and reconnect counts. 0 disables the reports.
+#define STATS_INTERVAL_MS       60000
+
+// ============================================================
+// BENCHMARK
+// ============================================================
+
+// Built by the esp32s3-bench environment (-DBENCHMARK=1). Instead of
+// taking turns, the satellite times its capture, encode, network and
+// playback paths at boot (and on every button press), checks the mic,
+// DAC, PSRAM and hub, and prints a one-line JSON report for comparing
+// boards and firmware builds. Network tests use the hub's /api/bench.
+#ifndef BENCHMARK
+#define BENCHMARK               0
+#endif
+#define BENCH_CAPTURE_MS        3000            // Mic capture at full rate
+#define BENCH_COPY_FRAMES       1000            // Frames timed for memcpy vs zero-copy
+#define BENCH_ENCODE_FRAMES     200             // Frames timed through the ADPCM encoder
+#define BENCH_NET_BYTES         (256 * 1024)    // Uploaded and downloaded
+#define BENCH_PLAYBACK_MS       2000            // Test tone through the DAC
+#define BENCH_TONE_HZ           440
+
+// ============================================================
+// TASK CONFIGURATION
+// ============================================================
+
+// The capture task owns the mic and runs on core 0; loop() (button,
+// network, playback) stays on the Arduino core 1. Its priority is above
+// lwIP's tcpip task (18) so a busy network can't hold it off, and below
+// the WiFi driver (23). It blocks in i2s_channel_read() almost all the time.
+#define CAPTURE_TASK_CORE       0
+#define CAPTURE_TASK_PRIORITY   19
+#if WAKE_WORD_ENABLED || ECHO_CANCEL
+#define CAPTURE_TASK_STACK      8192    // WakeNet and the AEC run on this stack too
+#else
+#define CAPTURE_TASK_STACK      4096
+#endif
+
+// The playback task feeds the DAC from core 1, next to loop() which fills
+// its ring from the socket. It sits above loop() so DAC writes come first.
+#define PLAYBACK_TASK_CORE      1
+#define PLAYBACK_TASK_PRIORITY  5
+#define PLAYBACK_TASK_STACK     4096
+
 // ============================================================
 // GLOBALS
 // ============================================================
 
-uint8_t* audioBuffer      = nullptr;  // Main recording buffer
+#if TRANSPORT == TRANSPORT_HTTP_BUFFERED
+uint8_t* audioBuffer      = nullptr;  // Whole recording, POSTed after release
 size_t   audioBufferPos   = 0;        // Current write position in buffer
-bool     isRecording      = false;
-bool     lastButtonState  = HIGH;     // Pull-up = HIGH when not pressed
+#endif
+size_t   recordedBytes    = 0;        // PCM captured this turn
+bool     recordingFull    = false;    // Hit MAX_RECORDING_SECS, ignoring further audio
+
+// Where the current turn is. loop() moves IDLE -> RECORDING on a press or
+// the wake word; finishRecording() runs UPLOADING -> PLAYING -> IDLE.
+enum TurnState { TURN_IDLE, TURN_RECORDING, TURN_UPLOADING, TURN_PLAYING };
+TurnState turnState = TURN_IDLE;
+
+// Button events. The edge ISR snapshots the capture position, a
+// debounce timer posts the event once the level has settled.
+enum ButtonEventType : uint8_t { BUTTON_PRESSED, BUTTON_RELEASED };
+struct ButtonEvent {
+    ButtonEventType type;
+    size_t   ringPos;                 // captureRing head at the edge
+    uint32_t captureReads;            // captureReads at the edge
+};
+QueueHandle_t     buttonQueue       = nullptr;
+TimerHandle_t     buttonTimer       = nullptr;
+volatile int      buttonStable      = HIGH;   // Last debounced level (pull-up = HIGH when not pressed)
+volatile bool     buttonEdgePending = false;  // First edge of a bounce burst seen, timer running
+volatile ButtonEvent buttonEdge;              // Snapshot taken at that edge
+
+// Connection to the hub for the HTTP transports, kept open between turns
+WiFiClient hubClient;
+std::atomic<bool> wifiUp(false);      // Set from WiFi events
+uint32_t   wifiLastAttempt = 0;       // millis() of the last background reconnect
+
+// Streaming upload (over hubClient)
+bool       uploadActive   = false;    // Request headers sent, body still open
+bool       uploadFirstChunk = true;   // No chunk written yet (no leading CRLF)
+
+// Uplink format, picked per turn (CODEC_PCM16 or CODEC_IMA_ADPCM at uplinkRate)
+int      uplinkCodec      = UPLINK_CODEC == CODEC_ADAPTIVE ? CODEC_PCM16 : UPLINK_CODEC;
+uint32_t uplinkRate       = SAMPLE_RATE;
+size_t   uplinkBytes      = 0;        // Audio bytes sent this turn (after encoding)
+float    uplinkLinkBps    = 0;        // CODEC_ADAPTIVE: estimated uplink bytes/s, 0 = not measured yet
+float    uplinkTurnSecs   = UPLINK_EXPECTED_SECS;   // ... and typical recording length
+
+// WebSocket session
+WebSocketsClient webSocket;
+bool     wsTurnActive     = false;    // "start" sent, "end" not yet
+bool     wsReplyDone      = false;    // Server finished replying to the current turn
+bool     wsPlaying        = false;    // Between "audio_start" and "audio_end"
+uint32_t wsLastActivity   = 0;        // millis() of the last frame from the server
+char     wsBargedTurnId[20] = "";     // Turn the user barged in on, its late messages are dropped
+
+// Sent as X-Satellite-ID so the hub can tell satellites apart
+char     satelliteId[33]  = "";
+String   wsExtraHeaders;                  // Satellite ID and playback rate headers for the WebSocket handshake
+
+// SERVER_URL split up for the raw-socket streaming upload
+String   serverHost;
+uint16_t serverPort       = 80;
+String   serverPath       = "/";
 
 // I2S port assignments
 #define I2S_MIC_PORT    I2S_NUM_0
 #define I2S_DAC_PORT    I2S_NUM_1
+i2s_chan_handle_t micChannel = nullptr;
+i2s_chan_handle_t dacChannel = nullptr;
+
+// Capture task
+TaskHandle_t      captureTaskHandle = nullptr;
+std::atomic<bool> captureEnabled(false);        // Capture task keeps frames only while set
+std::atomic<bool> captureArmed(false);          // ... or this: set at a press edge, before it is debounced
+std::atomic<uint32_t> captureReads(0);          // Completed mic reads
+std::atomic<bool> wakeListening(false);         // Capture task runs WakeNet and keeps the pre-roll
+std::atomic<bool> wakeDetected(false);          // Set by the capture task, taken by loop()
+std::atomic<size_t> wakeRingPos(0);             // captureRing head when the wake word fired
+bool turnFromWake = false;                      // Current recording was started by the wake word
+unsigned long recordingStartMs = 0;
+std::atomic<uint32_t> captureRingDrops(0);      // Bytes lost because the ring was full
+std::atomic<uint32_t> micDmaOverruns(0);        // I2S DMA overflows reported by the driver
+#if BENCHMARK
+std::atomic<uint32_t> benchProcessUs(0);        // Capture task time in AEC + front end
+std::atomic<uint32_t> benchProcessFrames(0);
+#endif
+
+// Playback task
+TaskHandle_t      playbackTaskHandle = nullptr;
+std::atomic<bool> playbackInputDone(false);     // Network side wrote the last byte of the reply
+std::atomic<bool> playbackRunning(false);       // Set by startPlayback(), cleared when the DAC is done
+std::atomic<bool> playbackStop(false);          // Barge-in: the playback task drops the rest of the reply
+uint32_t          playbackRate = SAMPLE_RATE;   // DAC clock, set per reply by startPlayback()
+std::atomic<uint32_t> dacDmaUnderruns(0);       // DAC DMA ran dry (auto-cleared to silence)
+uint32_t          lastPlayUnderruns  = 0;       // Counts of the last reply, for the benchmark
+uint32_t          lastPlayUnderflows = 0;
+
+// Health counters, totals since boot. The per-turn counters above are
+// added in when they're reset.
+uint32_t              statsMicOverruns    = 0;
+uint32_t              statsCaptureDrops   = 0;
+std::atomic<uint32_t> statsPlayUnderruns(0);    // Added by the playback task after each reply
+std::atomic<uint32_t> statsDacUnderflows(0);
+std::atomic<uint32_t> statsWifiDisconnects(0);
+uint32_t              statsHubConnects    = 0;
+uint32_t              statsLastMs         = 0;  // millis() of the last report
+
+// Barge-in
+bool bargeInPending   = false;                  // Reply interrupted, loop() starts the next turn
+bool echoCancelActive = false;                  // AEC running, the wake word is live during playback
+
+// Power management
+TaskHandle_t         loopTaskHandle = nullptr;  // Woken by button events
+esp_pm_lock_handle_t pmAwakeLock    = nullptr;  // Held while awake: full CPU clock, no light sleep
+bool pmLightSleep = false;                      // Automatic light sleep is configured
+bool idleAsleep   = false;                      // I2S stopped, light sleep allowed
+unsigned long lastActiveMs = 0;
+std::atomic<bool> micPauseRequested(false);     // Capture task stops the mic channel while set
 
 // ============================================================
 // I2S SETUP
 // ============================================================
 
+// Driver event callbacks, called from the I2S ISR: count only
+static bool IRAM_ATTR micOnOverflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* ctx) {
+    micDmaOverruns++;   // Capture task fell behind, a DMA buffer was overwritten
+    return false;
+}
+
+static bool IRAM_ATTR dacOnUnderflow(i2s_chan_handle_t handle, i2s_event_data_t* event, void* ctx) {
+    dacDmaUnderruns++;  // Playback task fell behind, auto_clear sent silence
+    return false;
+}
+
 void setupI2SMic() {
-    i2s_config_t i2s_config = {
-        .mode                 = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX),
-        .sample_rate          = SAMPLE_RATE,
-        .bits_per_sample      = I2S_BITS_PER_SAMPLE_16BIT,
-        .channel_format       = I2S_CHANNEL_FMT_ONLY_LEFT,  // INMP441 L/R pin to GND = left channel
-        .communication_format = I2S_COMM_FORMAT_STAND_I2S,
-        .intr_alloc_flags     = ESP_INTR_FLAG_LEVEL1,
-        .dma_buf_count        = 8,
-        .dma_buf_len          = 256,
-        .use_apll             = false,
-        .tx_desc_auto_clear   = false,
-        .fixed_mclk           = 0
-    };
-
-    i2s_pin_config_t pin_config = {
-        .bck_io_num   = I2S_MIC_SCK,
-        .ws_io_num    = I2S_MIC_WS,
-        .data_out_num = I2S_PIN_NO_CHANGE,  // No output on mic port
-        .data_in_num  = I2S_MIC_SD
-    };
-
-    i2s_driver_install(I2S_MIC_PORT, &i2s_config, 0, NULL);
-    i2s_set_pin(I2S_MIC_PORT, &pin_config);
-    i2s_zero_dma_buffer(I2S_MIC_PORT);
-
-    Serial.println("[I2S] Microphone initialized on I2S_NUM_0");
+    i2s_chan_config_t chan_config = I2S_CHANNEL_DEFAULT_CONFIG(I2S_MIC_PORT, I2S_ROLE_MASTER);
+    chan_config.dma_desc_num  = MIC_DMA_DESC_NUM;
+    chan_config.dma_frame_num = MIC_DMA_FRAME_NUM;
+    ESP_ERROR_CHECK(i2s_new_channel(&chan_config, nullptr, &micChannel));
+
+    i2s_std_config_t std_config = {};
+    std_config.clk_cfg  = I2S_STD_CLK_DEFAULT_CONFIG(SAMPLE_RATE);
+    std_config.slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO);
+    std_config.slot_cfg.slot_mask = I2S_STD_SLOT_LEFT;   // INMP441 L/R pin to GND = left channel
+    std_config.gpio_cfg.mclk = I2S_GPIO_UNUSED;
+    std_config.gpio_cfg.bclk = (gpio_num_t)I2S_MIC_SCK;
+    std_config.gpio_cfg.ws   = (gpio_num_t)I2S_MIC_WS;
+    std_config.gpio_cfg.dout = I2S_GPIO_UNUSED;          // No output on mic port
+    std_config.gpio_cfg.din  = (gpio_num_t)I2S_MIC_SD;
+    ESP_ERROR_CHECK(i2s_channel_init_std_mode(micChannel, &std_config));
+
+    i2s_event_callbacks_t callbacks = {};
+    callbacks.on_recv_q_ovf = micOnOverflow;
+    i2s_channel_register_event_callback(micChannel, &callbacks, nullptr);
+    ESP_ERROR_CHECK(i2s_channel_enable(micChannel));
+
+    Serial.printf("[I2S] Microphone initialized on I2S_NUM_0 (%d x %d frame DMA)\n",
+                  MIC_DMA_DESC_NUM, MIC_DMA_FRAME_NUM);
 }
 
 void setupI2SDAC() {
-    i2s_config_t i2s_config = {
-        .mode                 = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),
-        .sample_rate          = SAMPLE_RATE,
-        .bits_per_sample      = I2S_BITS_PER_SAMPLE_16BIT,
-        .channel_format       = I2S_CHANNEL_FMT_ONLY_LEFT,
-        .communication_format = I2S_COMM_FORMAT_STAND_I2S,
-        .intr_alloc_flags     = ESP_INTR_FLAG_LEVEL1,
-        .dma_buf_count        = 8,
-        .dma_buf_len          = 256,
-        .use_apll             = false,
-        .tx_desc_auto_clear   = true,   // Auto-clear TX buffer on underflow
-        .fixed_mclk           = 0
-    };
-
-    i2s_pin_config_t pin_config = {
-        .bck_io_num   = I2S_DAC_BCK,
-        .ws_io_num    = I2S_DAC_LCK,
-        .data_out_num = I2S_DAC_DIN,
-        .data_in_num  = I2S_PIN_NO_CHANGE   // No input on DAC port
-    };
-
-    i2s_driver_install(I2S_DAC_PORT, &i2s_config, 0, NULL);
-    i2s_set_pin(I2S_DAC_PORT, &pin_config);
-    i2s_zero_dma_buffer(I2S_DAC_PORT);
-
-    Serial.println("[I2S] DAC initialized on I2S_NUM_1");
+    i2s_chan_config_t chan_config = I2S_CHANNEL_DEFAULT_CONFIG(I2S_DAC_PORT, I2S_ROLE_MASTER);
+    chan_config.dma_desc_num  = DAC_DMA_DESC_NUM;
+    chan_config.dma_frame_num = DAC_DMA_FRAME_NUM;
+    chan_config.auto_clear    = true;   // Send silence on underflow
+    ESP_ERROR_CHECK(i2s_new_channel(&chan_config, &dacChannel, nullptr));
+
+    i2s_std_config_t std_config = {};
+    std_config.clk_cfg  = I2S_STD_CLK_DEFAULT_CONFIG(SAMPLE_RATE);
+    std_config.slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO);
+    std_config.gpio_cfg.mclk = I2S_GPIO_UNUSED;
+    std_config.gpio_cfg.bclk = (gpio_num_t)I2S_DAC_BCK;
+    std_config.gpio_cfg.ws   = (gpio_num_t)I2S_DAC_LCK;
+    std_config.gpio_cfg.dout = (gpio_num_t)I2S_DAC_DIN;
+    std_config.gpio_cfg.din  = I2S_GPIO_UNUSED;          // No input on DAC port
+    ESP_ERROR_CHECK(i2s_channel_init_std_mode(dacChannel, &std_config));
+
+    i2s_event_callbacks_t callbacks = {};
+    callbacks.on_send_q_ovf = dacOnUnderflow;
+    i2s_channel_register_event_callback(dacChannel, &callbacks, nullptr);
+    ESP_ERROR_CHECK(i2s_channel_enable(dacChannel));
+
+    Serial.printf("[I2S] DAC initialized on I2S_NUM_1 (%d x %d frame DMA)\n",
+                  DAC_DMA_DESC_NUM, DAC_DMA_FRAME_NUM);
+}
+
+// Replace whatever is still queued in the DAC's DMA with silence, so an
+// interrupted reply stops at once instead of playing out its tail
+void dacSilence() {
+    static const uint8_t zeros[PLAYBACK_BLOCK_SIZE] = {};
+    i2s_channel_disable(dacChannel);
+    size_t loaded = 0;
+    do {
+        i2s_channel_preload_data(dacChannel, zeros, sizeof(zeros), &loaded);
+    } while (loaded == sizeof(zeros));
+    i2s_channel_enable(dacChannel);
+}
+
+// ============================================================
+// AUDIO RING BUFFER
+// ============================================================
+//
+// Single-producer / single-consumer ring, lock-free: only the producer
+// moves `head` and only the consumer moves `tail`. Both are free-running
+// byte counters, masked into the buffer on access, so full and empty
+// never look the same.
+
+struct AudioRing {
+    uint8_t*            buf  = nullptr;
+    size_t              size = 0;      // Power of two
+    std::atomic<size_t> head{0};       // Total bytes written (producer)
+    std::atomic<size_t> tail{0};       // Total bytes read (consumer)
+};
+
+AudioRing captureRing;                 // Capture task -> loop()
+AudioRing playbackRing;                // loop() -> playback task
+AudioRing echoRefRing;                 // Playback task -> capture task (speaker reference for the AEC)
+
+bool ringInit(AudioRing* ring, size_t size) {
+    ring->buf = (uint8_t*)ps_malloc(size);
+    if (!ring->buf) {
+        ring->buf = (uint8_t*)malloc(size);
+    }
+    ring->size = size;
+    ring->head.store(0);
+    ring->tail.store(0);
+    return ring->buf != nullptr;
+}
+
+// Bytes ready to be read (consumer side)
+size_t ringAvailable(AudioRing* ring) {
+    return ring->head.load(std::memory_order_acquire) - ring->tail.load(std::memory_order_relaxed);
+}
+
+// Bytes that can be written without overwriting unread data (producer side)
+size_t ringFree(AudioRing* ring) {
+    return ring->size - (ring->head.load(std::memory_order_relaxed) -
+                         ring->tail.load(std::memory_order_acquire));
+}
+
+// Producer: copy in as much as fits, returns bytes written
+size_t ringWrite(AudioRing* ring, const uint8_t* data, size_t len) {
+    len = min(len, ringFree(ring));
+    size_t head  = ring->head.load(std::memory_order_relaxed);
+    size_t start = head & (ring->size - 1);
+    size_t first = min(len, ring->size - start);
+
+    memcpy(ring->buf + start, data, first);
+    memcpy(ring->buf, data + first, len - first);
+
+    ring->head.store(head + len, std::memory_order_release);
+    return len;
+}
+
+// Consumer: copy out up to `len` bytes, returns bytes read
+size_t ringRead(AudioRing* ring, uint8_t* data, size_t len) {
+    len = min(len, ringAvailable(ring));
+    size_t tail  = ring->tail.load(std::memory_order_relaxed);
+    size_t start = tail & (ring->size - 1);
+    size_t first = min(len, ring->size - start);
+
+    memcpy(data, ring->buf + start, first);
+    memcpy(data + first, ring->buf, len - first);
+
+    ring->tail.store(tail + len, std::memory_order_release);
+    return len;
+}
+
+// Producer, zero-copy: contiguous free space at the write position. Fill
+// it in place, then ringCommit() the bytes written.
+uint8_t* ringWriteSpan(AudioRing* ring, size_t* len) {
+    size_t start = ring->head.load(std::memory_order_relaxed) & (ring->size - 1);
+    *len = min(ringFree(ring), ring->size - start);
+    return ring->buf + start;
+}
+
+void ringCommit(AudioRing* ring, size_t len) {
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
+
+// Consumer, zero-copy: contiguous readable data at the read position. Use
+// it in place, then ringConsume() the bytes used.
+const uint8_t* ringReadSpan(AudioRing* ring, size_t* len) {
+    size_t start = ring->tail.load(std::memory_order_relaxed) & (ring->size - 1);
+    *len = min(ringAvailable(ring), ring->size - start);
+    return ring->buf + start;
+}
+
+void ringConsume(AudioRing* ring, size_t len) {
+    ring->tail.store(ring->tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
+
+// Consumer: drop everything currently buffered
+void ringClear(AudioRing* ring) {
+    ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+// Drop everything before `pos`, or everything if `pos` is no longer in the ring
+void ringSkipTo(AudioRing* ring, size_t pos) {
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    size_t head = ring->head.load(std::memory_order_acquire);
+    ring->tail.store((size_t)(pos - tail) <= (size_t)(head - tail) ? pos : head, std::memory_order_release);
+}
+
+// Empty the ring while neither side is using it
+void ringReset(AudioRing* ring) {
+    ring->head.store(0);
+    ring->tail.store(0);
 }
 
 // ============================================================
 // WAV HEADER
 // ============================================================
 
-void writeWavHeader(uint8_t* buf, uint32_t dataSize) {
-    uint32_t fileSize    = dataSize + WAV_HEADER_SIZE - 8;
-    uint32_t byteRate    = SAMPLE_RATE * CHANNELS * BYTES_PER_SAMPLE;
+void writeWavHeader(uint8_t* buf, uint32_t dataSize, uint32_t sampleRate = SAMPLE_RATE) {
+    uint32_t fileSize    = (dataSize == WAV_STREAMING_SIZE) ? WAV_STREAMING_SIZE
+                                                            : dataSize + WAV_HEADER_SIZE - 8;
+    uint32_t byteRate    = sampleRate * CHANNELS * BYTES_PER_SAMPLE;
     uint16_t blockAlign  = CHANNELS * BYTES_PER_SAMPLE;
 
     // RIFF chunk
@@ -158,10 +723,10 @@ void writeWavHeader(uint8_t* buf, uint32_t dataSize) {
     buf[16] = 16;  buf[17] = 0;   buf[18] = 0;   buf[19] = 0;   // Sub-chunk size (16 for PCM)
     buf[20] = 1;   buf[21] = 0;                                   // Audio format (1 = PCM)
     buf[22] = (uint8_t)CHANNELS;  buf[23] = 0;                    // Num channels
-    buf[24] = (uint8_t)(SAMPLE_RATE);
-    buf[25] = (uint8_t)(SAMPLE_RATE >> 8);
-    buf[26] = (uint8_t)(SAMPLE_RATE >> 16);
-    buf[27] = (uint8_t)(SAMPLE_RATE >> 24);
+    buf[24] = (uint8_t)(sampleRate);
+    buf[25] = (uint8_t)(sampleRate >> 8);
+    buf[26] = (uint8_t)(sampleRate >> 16);
+    buf[27] = (uint8_t)(sampleRate >> 24);
     buf[28] = (uint8_t)(byteRate);
     buf[29] = (uint8_t)(byteRate >> 8);
     buf[30] = (uint8_t)(byteRate >> 16);
@@ -177,250 +742,3045 @@ void writeWavHeader(uint8_t* buf, uint32_t dataSize) {
     buf[43] = (uint8_t)(dataSize >> 24);
 }
 
-// ============================================================
-// WiFi
-// ============================================================
+static void putLE16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+static void putLE32(uint8_t* p, uint32_t v) { putLE16(p, (uint16_t)v); putLE16(p + 2, (uint16_t)(v >> 16)); }
+static uint16_t getLE16(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t getLE32(const uint8_t* p) { return getLE16(p) | ((uint32_t)getLE16(p + 2) << 16); }
+
+// Sample rate of a reply's 44-byte WAV header, or 0 if it isn't the
+// 16-bit mono PCM the DAC plays
+uint32_t replyWavRate(const uint8_t* header) {
+    if (memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) return 0;
+    if (getLE16(header + 20) != 1 || getLE16(header + 22) != 1 || getLE16(header + 34) != 16) return 0;
+    return getLE32(header + 24);
+}
 
-void connectWiFi() {
-    Serial.printf("[WiFi] Connecting to %s", WIFI_SSID);
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+// IMA-ADPCM WAV header (format 0x11) with the fact chunk, 60 bytes
+void writeAdpcmWavHeader(uint8_t* buf, uint32_t dataSize, uint32_t sampleRate = SAMPLE_RATE) {
+    bool     streaming   = (dataSize == WAV_STREAMING_SIZE);
+    uint32_t fileSize    = streaming ? WAV_STREAMING_SIZE : dataSize + ADPCM_WAV_HEADER_SIZE - 8;
+    uint32_t sampleCount = streaming ? WAV_STREAMING_SIZE
+                                     : dataSize / ADPCM_BLOCK_SIZE * ADPCM_SAMPLES_PER_BLOCK;
+    uint32_t byteRate    = sampleRate * ADPCM_BLOCK_SIZE / ADPCM_SAMPLES_PER_BLOCK;
+
+    memcpy(buf, "RIFF", 4);      putLE32(buf + 4, fileSize);
+    memcpy(buf + 8, "WAVE", 4);
+
+    memcpy(buf + 12, "fmt ", 4); putLE32(buf + 16, 20);          // Sub-chunk size (20 for ADPCM)
+    putLE16(buf + 20, 0x11);                                      // Audio format (0x11 = IMA-ADPCM)
+    putLE16(buf + 22, CHANNELS);
+    putLE32(buf + 24, sampleRate);
+    putLE32(buf + 28, byteRate);
+    putLE16(buf + 32, ADPCM_BLOCK_SIZE);                          // Block align
+    putLE16(buf + 34, 4);                                         // Bits per sample
+    putLE16(buf + 36, 2);                                         // Extra format bytes
+    putLE16(buf + 38, ADPCM_SAMPLES_PER_BLOCK);
+
+    memcpy(buf + 40, "fact", 4); putLE32(buf + 44, 4);
+    putLE32(buf + 48, sampleCount);
+
+    memcpy(buf + 52, "data", 4); putLE32(buf + 56, dataSize);
+}
 
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && attempts < 30) {
-        delay(500);
-        Serial.print(".");
-        attempts++;
-    }
+size_t uplinkHeaderSize() {
+    return uplinkCodec == CODEC_IMA_ADPCM ? ADPCM_WAV_HEADER_SIZE : WAV_HEADER_SIZE;
+}
 
-    if (WiFi.status() == WL_CONNECTED) {
-        Serial.printf("\n[WiFi] Connected! IP: %s\n", WiFi.localIP().toString().c_str());
+// Header of an upload in the current uplink format (streamed: size not
+// known yet), returns its size
+size_t writeUplinkWavHeader(uint8_t* buf, uint32_t dataSize = WAV_STREAMING_SIZE) {
+    if (uplinkCodec == CODEC_IMA_ADPCM) {
+        writeAdpcmWavHeader(buf, dataSize, uplinkRate);
     } else {
-        Serial.println("\n[WiFi] FAILED to connect. Check credentials.");
+        writeWavHeader(buf, dataSize, uplinkRate);
     }
+    return uplinkHeaderSize();
 }
 
 // ============================================================
-// RECORDING
+// IMA-ADPCM ENCODER
 // ============================================================
+//
+// Standard WAV IMA-ADPCM, so saved uploads open in any audio tool. Every
+// block starts with the first sample and the step index in a 4-byte
+// header, followed by 504 samples at 4 bits, low nibble first. Capture
+// frames don't line up with blocks, so samples are collected until a
+// block is complete.
+
+static const int16_t ADPCM_STEP_TABLE[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+static const int8_t ADPCM_INDEX_TABLE[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+struct AdpcmEncoder {
+    uint8_t block[ADPCM_BLOCK_SIZE];  // Block being encoded
+    size_t  count     = 0;            // Samples in it so far
+    int     predictor = 0;
+    int     index     = 0;            // Carried over from block to block
+    int16_t last      = 0;            // Last sample, pads the final block
+};
+
+AdpcmEncoder adpcmEncoder;
+
+// Receives each completed ADPCM_BLOCK_SIZE block
+typedef void (*AdpcmSink)(const uint8_t* block, size_t len);
+
+static uint8_t adpcmEncodeSample(AdpcmEncoder* enc, int sample) {
+    int step = ADPCM_STEP_TABLE[enc->index];
+    int diff = sample - enc->predictor;
+    uint8_t nibble = 0;
+
+    if (diff < 0) {
+        nibble = 8;
+        diff = -diff;
+    }
 
-void startRecording() {
-    audioBufferPos = WAV_HEADER_SIZE;  // Leave room for WAV header
-    isRecording = true;
-    digitalWrite(LED_PIN, HIGH);       // LED on while recording
-    Serial.println("[REC] Recording started...");
-}
-
-void captureAudioChunk() {
-    if (!isRecording) return;
+    int vpdiff = step >> 3;
+    if (diff >= step)        { nibble |= 4; diff -= step;        vpdiff += step; }
+    if (diff >= (step >> 1)) { nibble |= 2; diff -= (step >> 1); vpdiff += step >> 1; }
+    if (diff >= (step >> 2)) { nibble |= 1;                      vpdiff += step >> 2; }
 
-    int16_t readBuf[I2S_READ_BUF_SIZE / 2];  // 16-bit samples
-    size_t bytesRead = 0;
+    enc->predictor += (nibble & 8) ? -vpdiff : vpdiff;
+    enc->predictor = constrain(enc->predictor, -32768, 32767);
+    enc->index = constrain(enc->index + ADPCM_INDEX_TABLE[nibble], 0, 88);
+    return nibble;
+}
 
-    esp_err_t result = i2s_read(
-        I2S_MIC_PORT,
-        readBuf,
-        I2S_READ_BUF_SIZE,
-        &bytesRead,
-        portMAX_DELAY
-    );
+static void adpcmAddSample(AdpcmEncoder* enc, int16_t sample, AdpcmSink emit) {
+    if (enc->count == 0) {
+        // Block header: first sample verbatim, step index, reserved byte
+        enc->predictor = sample;
+        putLE16(enc->block, (uint16_t)sample);
+        enc->block[2] = (uint8_t)enc->index;
+        enc->block[3] = 0;
+    } else {
+        uint8_t nibble = adpcmEncodeSample(enc, sample);
+        size_t  n      = enc->count - 1;
+        uint8_t* byte  = enc->block + 4 + n / 2;
+        *byte = (n & 1) ? (*byte | (nibble << 4)) : nibble;
+    }
 
-    if (result == ESP_OK && bytesRead > 0) {
-        // Check if we have room in the buffer
-        if (audioBufferPos + bytesRead <= MAX_AUDIO_BYTES + WAV_HEADER_SIZE) {
-            memcpy(audioBuffer + audioBufferPos, readBuf, bytesRead);
-            audioBufferPos += bytesRead;
-        } else {
-            // Buffer full - stop recording
-            Serial.println("[REC] Buffer full, stopping.");
-            isRecording = false;
-            digitalWrite(LED_PIN, LOW);
-        }
+    enc->last = sample;
+    if (++enc->count == ADPCM_SAMPLES_PER_BLOCK) {
+        emit(enc->block, ADPCM_BLOCK_SIZE);
+        enc->count = 0;
     }
 }
 
-void stopRecording() {
-    isRecording = false;
-    digitalWrite(LED_PIN, LOW);
-
-    size_t audioDataSize = audioBufferPos - WAV_HEADER_SIZE;
-    float durationSecs = (float)audioDataSize / (SAMPLE_RATE * BYTES_PER_SAMPLE);
+void adpcmReset(AdpcmEncoder* enc) {
+    enc->count = 0;
+    enc->predictor = 0;
+    enc->index = 0;
+    enc->last = 0;          // Padding of the final block, not the previous turn's last sample
+}
 
-    Serial.printf("[REC] Stopped. Recorded %.1f seconds (%d bytes)\n",
-                  durationSecs, audioDataSize);
+// Encode samples, passing every completed block to `emit`
+void adpcmEncode(AdpcmEncoder* enc, const int16_t* pcm, size_t samples, AdpcmSink emit) {
+    for (size_t i = 0; i < samples; i++) {
+        adpcmAddSample(enc, pcm[i], emit);
+    }
+}
 
-    // Write WAV header at the beginning of the buffer
-    writeWavHeader(audioBuffer, audioDataSize);
+// Pad the last partial block with its final sample and emit it
+void adpcmFlush(AdpcmEncoder* enc, AdpcmSink emit) {
+    while (enc->count > 0) {
+        adpcmAddSample(enc, enc->last, emit);
+    }
 }
 
 // ============================================================
-// HTTP SEND & RECEIVE
+// 8 KHZ DECIMATOR
 // ============================================================
-
-void sendAudioToServer() {
-    if (WiFi.status() != WL_CONNECTED) {
-        Serial.println("[HTTP] WiFi not connected, skipping send.");
-        return;
+//
+// Halves the uplink rate for the weakest links: a 7-tap half-band
+// low-pass (-1 0 9 16 9 0 -1)/32, about -25 dB from 6 kHz up so little
+// aliases into the 0-4 kHz band STT needs, then every other sample.
+// The window carries over between frames.
+
+struct Decimator {
+    int16_t window[7] = {};           // Last input samples, newest last
+    bool    odd       = false;        // Next input sample is dropped
+};
+
+Decimator uplinkDecimator;
+
+// `out` needs room for samples / 2 + 1; returns the samples written
+size_t decimate(Decimator* dec, const int16_t* in, size_t samples, int16_t* out) {
+    int16_t* w = dec->window;
+    size_t n = 0;
+    for (size_t i = 0; i < samples; i++) {
+        memmove(w, w + 1, 6 * sizeof(int16_t));
+        w[6] = in[i];
+        dec->odd = !dec->odd;
+        if (!dec->odd) continue;
+
+        int32_t acc = 16 * w[3] + 9 * (w[2] + w[4]) - (w[0] + w[6]);
+        out[n++] = (int16_t)constrain((acc + 16) >> 5, -32768, 32767);
     }
+    return n;
+}
 
-    size_t totalSize = audioBufferPos;  // WAV header + audio data
-    Serial.printf("[HTTP] Sending %d bytes to %s\n", totalSize, SERVER_URL);
-
-    // Blink LED rapidly to indicate "processing"
-    digitalWrite(LED_PIN, HIGH);
-
-    HTTPClient http;
-    http.begin(SERVER_URL);
-    http.addHeader("Content-Type", "audio/wav");
-    http.setTimeout(30000);  // 30 second timeout (AI processing takes time)
-
-    int httpCode = http.POST(audioBuffer, totalSize);
-
-    if (httpCode == 200) {
-        Serial.printf("[HTTP] Response received: %d\n", httpCode);
+void decimatorReset(Decimator* dec) {
+    memset(dec->window, 0, sizeof(dec->window));
+    dec->odd = false;
+}
 
-        String contentType = http.header("Content-Type");
-        int responseLen = http.getSize();
+// ============================================================
+// UPLINK ADAPTATION
+// ============================================================
+//
+// CODEC_ADAPTIVE keeps one estimate of the uplink's throughput. A turn
+// where the link was the limit (the buffered POST, or a streamed upload
+// still draining after release) measures it. A streamed turn that kept
+// up only shows the link carries that format, so the estimate grows by
+// UPLINK_PROBE_GAIN and a better format gets tried once it would fit.
+
+struct UplinkFormat {
+    int         codec;
+    uint32_t    sampleRate;
+    const char* name;
+};
+
+// Best first
+const UplinkFormat UPLINK_FORMATS[] = {
+    { CODEC_PCM16,     SAMPLE_RATE,     "PCM 16 kHz" },
+    { CODEC_IMA_ADPCM, SAMPLE_RATE,     "IMA-ADPCM 16 kHz" },
+    { CODEC_IMA_ADPCM, SAMPLE_RATE / 2, "IMA-ADPCM 8 kHz" },
+};
+const size_t UPLINK_FORMAT_COUNT = sizeof(UPLINK_FORMATS) / sizeof(UPLINK_FORMATS[0]);
+
+float uplinkByteRate(int codec, uint32_t sampleRate) {
+    return codec == CODEC_IMA_ADPCM ? (float)sampleRate * ADPCM_BLOCK_SIZE / ADPCM_SAMPLES_PER_BLOCK
+                                    : (float)sampleRate * BYTES_PER_SAMPLE;
+}
 
-        if (contentType.startsWith("audio/wav") && responseLen > WAV_HEADER_SIZE) {
-            // Response is audio — play it through the speaker
-            Serial.printf("[HTTP] Audio response: %d bytes\n", responseLen);
-
-            if (responseLen <= MAX_AUDIO_BYTES + WAV_HEADER_SIZE) {
-                WiFiClient* stream = http.getStreamPtr();
-                size_t bytesRead = 0;
-
-                while (bytesRead < responseLen) {
-                    size_t available = stream->available();
-                    if (available) {
-                        size_t toRead = min(available, (size_t)(responseLen - bytesRead));
-                        size_t got = stream->readBytes(audioBuffer + bytesRead, toRead);
-                        bytesRead += got;
-                    } else {
-                        delay(1);
-                    }
-                }
-                playAudio(bytesRead);
-            } else {
-                Serial.println("[HTTP] Audio response too large for buffer.");
-            }
-        } else {
-            // Response is JSON or text — print it to serial (e.g. transcription result)
-            String body = http.getString();
-            Serial.println("[HTTP] Server response:");
-            Serial.println(body);
-        }
-    } else {
-        Serial.printf("[HTTP] Error: %d - %s\n", httpCode, http.errorToString(httpCode).c_str());
+// Set uplinkCodec / uplinkRate for the turn that is starting
+void uplinkPick() {
+#if UPLINK_CODEC == CODEC_ADAPTIVE
+    int rssi = WiFi.RSSI();
+    size_t pick = rssi < UPLINK_RSSI_POOR ? 2 : rssi < UPLINK_RSSI_WEAK ? 1 : 0;
+    for (; uplinkLinkBps > 0 && pick < UPLINK_FORMAT_COUNT - 1; pick++) {
+        // Seconds of upload left after release per second recorded
+        float behind = uplinkByteRate(UPLINK_FORMATS[pick].codec, UPLINK_FORMATS[pick].sampleRate) / uplinkLinkBps;
+#if TRANSPORT != TRANSPORT_HTTP_BUFFERED
+        behind -= 1.0f;     // Streamed while recording
+#endif
+        if (behind * uplinkTurnSecs * 1000 <= UPLINK_BUDGET_MS) break;
     }
+    uplinkCodec = UPLINK_FORMATS[pick].codec;
+    uplinkRate  = UPLINK_FORMATS[pick].sampleRate;
+    Serial.printf("[UPLINK] %s (link %.1f KB/s, RSSI %d dBm)\n",
+                  UPLINK_FORMATS[pick].name, uplinkLinkBps / 1024, rssi);
+#endif
+}
 
-    http.end();
-    digitalWrite(LED_PIN, LOW);
+// After a turn: `bytes` took `us` on the link; `limited` if the link was
+// the bottleneck for them. `recordedSecs` is the turn's recording length.
+void uplinkMeasure(size_t bytes, int64_t us, bool limited, float recordedSecs) {
+#if UPLINK_CODEC == CODEC_ADAPTIVE
+    uplinkTurnSecs = 0.7f * uplinkTurnSecs + 0.3f * recordedSecs;
+    const float ceiling = 2 * uplinkByteRate(CODEC_PCM16, SAMPLE_RATE);
+
+    if (limited && bytes > 0 && us > 0) {
+        float measured = bytes * 1e6f / us;
+        // Down at once, up averaged
+        uplinkLinkBps = (uplinkLinkBps <= 0 || measured < uplinkLinkBps) ? measured
+                                                                         : 0.5f * (uplinkLinkBps + measured);
+    } else if (!limited) {
+        uplinkLinkBps = max(uplinkLinkBps, uplinkByteRate(uplinkCodec, uplinkRate)) * UPLINK_PROBE_GAIN;
+    }
+    uplinkLinkBps = min(uplinkLinkBps, ceiling);
+#endif
 }
 
 // ============================================================
-// AUDIO PLAYBACK
+// WiFi
 // ============================================================
 
-void playAudio(size_t totalBytes) {
-    Serial.printf("[PLAY] Playing %d bytes of audio...\n", totalBytes);
+void onWiFiEvent(arduino_event_id_t event) {
+    if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+        if (!wifiUp.exchange(true)) {
+            Serial.printf("[WiFi] Link up, IP: %s\n", WiFi.localIP().toString().c_str());
+        }
+    } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+        if (wifiUp.exchange(false)) {
+            statsWifiDisconnects++;
+            Serial.println("[WiFi] Link lost");
+        }
+    }
+}
 
-    // Skip the WAV header (44 bytes) - we just need the raw PCM data
-    size_t offset = WAV_HEADER_SIZE;
-    size_t remaining = totalBytes - WAV_HEADER_SIZE;
+// Boot-time connect. Gives up after ~15 s; connectionService() keeps
+// trying from loop() after that.
+void connectWiFi() {
+    Serial.printf("[WiFi] Connecting to %s", WIFI_SSID);
+    WiFi.mode(WIFI_STA);
+    WiFi.onEvent(onWiFiEvent);
+    WiFi.setAutoReconnect(true);
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+    wifiLastAttempt = millis();
 
-    // Write audio data to DAC in chunks
-    size_t chunkSize = 1024;
-    size_t bytesWritten = 0;
+    int attempts = 0;
+    while (WiFi.status() != WL_CONNECTED && attempts < 30) {
+        delay(500);
+        Serial.print(".");
+        attempts++;
+    }
 
-    while (offset < totalBytes) {
-        size_t toWrite = min(chunkSize, totalBytes - offset);
-        size_t written = 0;
+    if (WiFi.status() == WL_CONNECTED) {
+        Serial.printf("\n[WiFi] Connected! IP: %s\n", WiFi.localIP().toString().c_str());
+    } else {
+        Serial.println("\n[WiFi] FAILED to connect. Check credentials. Retrying in the background.");
+    }
+}
 
-        i2s_write(I2S_DAC_PORT, audioBuffer + offset, toWrite, &written, portMAX_DELAY);
+void initSatelliteId() {
+    if (SATELLITE_ID[0]) {
+        snprintf(satelliteId, sizeof(satelliteId), "%s", SATELLITE_ID);
+    } else {
+        uint8_t mac[6];
+        WiFi.macAddress(mac);
+        snprintf(satelliteId, sizeof(satelliteId), "sat-%02x%02x%02x%02x%02x%02x",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+    Serial.printf("[WiFi] Satellite ID: %s\n", satelliteId);
+}
 
-        offset += written;
-        bytesWritten += written;
+// Split SERVER_URL ("http://host:port/path") into host, port and path
+void parseServerUrl() {
+    String url = SERVER_URL;
+    if (url.startsWith("http://")) {
+        url = url.substring(7);
     }
 
-    // Flush any remaining data in DMA buffers
-    i2s_zero_dma_buffer(I2S_DAC_PORT);
+    int slash = url.indexOf('/');
+    String hostPort = (slash >= 0) ? url.substring(0, slash) : url;
+    serverPath      = (slash >= 0) ? url.substring(slash) : String("/");
 
-    float durationSecs = (float)(totalBytes - WAV_HEADER_SIZE) / (SAMPLE_RATE * BYTES_PER_SAMPLE);
-    Serial.printf("[PLAY] Done. Played %.1f seconds\n", durationSecs);
+    int colon = hostPort.indexOf(':');
+    if (colon >= 0) {
+        serverHost = hostPort.substring(0, colon);
+        serverPort = (uint16_t)hostPort.substring(colon + 1).toInt();
+    } else {
+        serverHost = hostPort;
+        serverPort = 80;
+    }
 }
 
 // ============================================================
-// SETUP & LOOP
+// HUB DISCOVERY
 // ============================================================
+//
+// Candidates are the SERVER_URL host plus every hub found over mDNS.
+// hubSelect() probes each one's /api/health and points serverHost /
+// serverPort at the lowest score: round trip + HUB_LOAD_PENALTY_MS per
+// turn the hub reports in progress or queued + a penalty for recent
+// failures. A round runs every HUB_PROBE_MS, and straight after a hub
+// failed a turn. Queries and probes block, so loop() takes one step per
+// pass (the mDNS query, then one probe each) and none while a turn is in
+// the making: a step is short enough for the capture ring to hold a
+// press that comes in during it, and webSocket.loop() runs in between.
+
+struct HubCandidate {
+    String   host;
+    uint16_t port;
+    int32_t  rttMs;         // Last probe, -1 if it didn't answer
+    int      load;          // Turns active + queued, from /api/health
+    uint8_t  failures;      // Failed turns since the last good probe
+};
+
+HubCandidate hubs[HUB_MAX];
+int      hubCount           = 0;
+int      hubCurrent         = -1;
+uint32_t hubLastProbe       = 0;
+int      hubProbeNext       = -1;       // Candidate the round probes next, -1 between rounds
+bool     hubFailoverPending = false;
+bool     hubChanged         = false;    // serverHost moved, loop() reconnects
+uint32_t wsDownSince        = 0;        // millis() the WebSocket dropped, 0 while connected
+
+int hubFind(const String& host, uint16_t port) {
+    for (int i = 0; i < hubCount; i++) {
+        if (hubs[i].host == host && hubs[i].port == port) return i;
+    }
+    return -1;
+}
 
-void setup() {
-    Serial.begin(115200);
-    delay(1000);
-    Serial.println("\n=============================");
-    Serial.println("  Voice Satellite - ESP32-S3");
-    Serial.println("=============================\n");
-
-    // GPIO setup
-    pinMode(BUTTON_PIN, INPUT_PULLUP);
-    pinMode(LED_PIN, OUTPUT);
-    digitalWrite(LED_PIN, LOW);
+void hubAdd(const String& host, uint16_t port) {
+    if (hubFind(host, port) >= 0 || hubCount >= HUB_MAX) return;
+    hubs[hubCount++] = HubCandidate{host, port, -1, 0, 0};
+}
 
-    // Allocate audio buffer (prefer PSRAM for larger buffer)
-    audioBuffer = (uint8_t*)ps_malloc(MAX_AUDIO_BYTES + WAV_HEADER_SIZE);
-    if (audioBuffer) {
-        Serial.printf("[MEM] Allocated %d bytes from PSRAM\n", MAX_AUDIO_BYTES + WAV_HEADER_SIZE);
-    } else {
-        // Fallback to regular RAM (smaller buffer)
-        audioBuffer = (uint8_t*)malloc(MAX_AUDIO_BYTES + WAV_HEADER_SIZE);
-        if (audioBuffer) {
-            Serial.printf("[MEM] Allocated %d bytes from heap (no PSRAM)\n", MAX_AUDIO_BYTES + WAV_HEADER_SIZE);
-        } else {
-            Serial.println("[MEM] FATAL: Could not allocate audio buffer!");
-            while (true) { delay(1000); }
+void hubDiscover() {
+#if HUB_DISCOVERY
+    // ESP-IDF's query, since MDNS.queryService() always waits 3 s
+    mdns_result_t* results = nullptr;
+    if (mdns_query_ptr("_" HUB_MDNS_SERVICE, "_tcp", HUB_MDNS_TIMEOUT_MS, HUB_MAX, &results) != ESP_OK) {
+        return;
+    }
+    for (mdns_result_t* result = results; result; result = result->next) {
+        for (mdns_ip_addr_t* address = result->addr; address; address = address->next) {
+            if (address->addr.type == ESP_IPADDR_TYPE_V4) {
+                hubAdd(IPAddress(address->addr.u_addr.ip4.addr).toString(), result->port);
+                break;
+            }
         }
     }
+    mdns_query_results_free(results);
+#endif
+}
 
-    // Initialize I2S
-    setupI2SMic();
-    setupI2SDAC();
+void hubProbe(HubCandidate& hub) {
+    HTTPClient http;
+    http.setConnectTimeout(HUB_PROBE_TIMEOUT_MS);
+    http.setTimeout(HUB_PROBE_TIMEOUT_MS);
 
-    // Connect to WiFi
-    connectWiFi();
+    uint32_t startMs = millis();
+    http.begin(hub.host, hub.port, "/api/health");
+    int httpCode = http.GET();
+    hub.rttMs = -1;
+    if (httpCode == 200) {
+        hub.rttMs = millis() - startMs;
+        JsonDocument health;
+        if (!deserializeJson(health, http.getString())) {
+            hub.load = (health["load"]["active_turns"] | 0) + (health["load"]["queued"] | 0);
+        }
+        hub.failures = 0;
+    }
+    http.end();
+}
 
-    Serial.println("\n[READY] Press and hold the button to record.");
-    Serial.println("[READY] Release to send audio to server.\n");
+int32_t hubScore(const HubCandidate& hub) {
+    return hub.rttMs + hub.load * HUB_LOAD_PENALTY_MS + hub.failures * HUB_FAILURE_PENALTY_MS;
 }
 
-void loop() {
-    bool buttonState = digitalRead(BUTTON_PIN);
+// Called once SERVER_URL is parsed: it's the first candidate
+void hubSetup() {
+    hubAdd(serverHost, serverPort);
+    hubCurrent = 0;
+#if HUB_DISCOVERY
+    if (!MDNS.begin(satelliteId)) {
+        Serial.println("[HUB] mDNS failed to start, using SERVER_URL only.");
+    }
+#endif
+}
+
+// Every candidate is probed: move to the best one
+void hubPick() {
+    int best = -1;
+    for (int i = 0; i < hubCount; i++) {
+        if (hubs[i].rttMs < 0) continue;
+        if (best < 0 || hubScore(hubs[i]) < hubScore(hubs[best])) best = i;
+    }
+    if (best < 0) {
+        Serial.println("[HUB] No hub answered, keeping the current one.");
+        return;
+    }
 
-    // Button just pressed (HIGH → LOW transition, because INPUT_PULLUP)
-    if (lastButtonState == HIGH && buttonState == LOW) {
-        startRecording();
+    // Stay put unless the best hub is clearly better (or ours is down)
+    const HubCandidate& current = hubs[hubCurrent];
+    if (best == hubCurrent ||
+        (current.rttMs >= 0 && hubScore(current) - hubScore(hubs[best]) < HUB_SWITCH_MARGIN_MS)) {
+        return;
     }
 
-    // Button is being held - capture audio
-    if (buttonState == LOW && isRecording) {
-        captureAudioChunk();
+    Serial.printf("[HUB] Switching to %s:%u (%d ms, load %d) from %s:%u\n",
+                  hubs[best].host.c_str(), hubs[best].port, (int)hubs[best].rttMs, hubs[best].load,
+                  current.host.c_str(), current.port);
+    hubCurrent = best;
+    serverHost = hubs[best].host;
+    serverPort = hubs[best].port;
+    hubChanged = true;
+}
+
+// Start a round: look for hubs, probing follows in hubProbeStep()
+void hubRoundStart() {
+    hubFailoverPending = false;
+    hubLastProbe = millis();
+    if (!wifiUp.load()) return;
+    hubDiscover();
+    hubProbeNext = 0;
+}
+
+// Probe the round's next candidate, pick the best after the last one
+void hubProbeStep() {
+    if (!wifiUp.load()) {
+        hubProbeNext = -1;          // Link lost, the next round starts over
+        return;
+    }
+    hubProbe(hubs[hubProbeNext++]);
+    if (hubProbeNext >= hubCount) {
+        hubProbeNext = -1;
+        hubPick();
     }
+}
 
-    // Button just released (LOW → HIGH transition)
-    if (lastButtonState == LOW && buttonState == HIGH && isRecording) {
-        stopRecording();
+// A whole round at once, for setup() where nothing else is waiting
+void hubSelect() {
+    hubRoundStart();
+    while (hubProbeNext >= 0) {
+        hubProbeStep();
+    }
+}
 
-        // Only send if we captured meaningful audio (> 0.3 seconds)
-        size_t audioDataSize = audioBufferPos - WAV_HEADER_SIZE;
-        float durationSecs = (float)audioDataSize / (SAMPLE_RATE * BYTES_PER_SAMPLE);
+// A press is coming in or a turn is under way: loop() must not block
+bool hubBusy() {
+    return turnState != TURN_IDLE || playbackRunning.load() || buttonEdgePending || captureArmed.load()
+           || buttonStable == LOW || uxQueueMessagesWaiting(buttonQueue) > 0 || wakeDetected.load();
+}
 
-        if (durationSecs > 0.3) {
-            sendAudioToServer();
-        } else {
-            Serial.println("[REC] Too short, discarding.");
-        }
+// The current hub failed a turn (no reply, connection refused or dropped):
+// find a better one before the next turn
+void hubFailed() {
+    if (hubCurrent >= 0 && hubs[hubCurrent].failures < 255) {
+        hubs[hubCurrent].failures++;
     }
+    hubFailoverPending = true;
+}
 
-    lastButtonState = buttonState;
+// Between turns: a step of the probe round, which starts when due or
+// right away after a failure
+void hubService() {
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    if (webSocket.isConnected()) {
+        wsDownSince = 0;
+    } else if (wsDownSince == 0) {
+        wsDownSince = millis();
+    } else if (millis() - wsDownSince > HUB_FAILOVER_MS) {
+        Serial.println("[HUB] WebSocket down, looking for another hub.");
+        wsDownSince = millis();
+        hubFailed();
+    }
+#endif
+    if (hubBusy()) return;
+    if (hubProbeNext >= 0) {
+        hubProbeStep();
+    } else if (hubFailoverPending || millis() - hubLastProbe > HUB_PROBE_MS) {
+        hubRoundStart();
+    }
+}
+
+// ============================================================
+// CONNECTION MANAGER
+// ============================================================
+//
+// A turn should never wait for the network to come up:
+// - The link is tracked from WiFi events. While it's down loop() retries
+//   every WIFI_RECONNECT_MS without blocking; recording works regardless.
+// - Modem sleep is only used between turns. During a turn the radio stays
+//   awake, otherwise every reply packet can wait for the next DTIM beacon.
+// - The HTTP transports send over hubClient, which is connected again
+//   right after each turn and checked on button press (reconnecting then
+//   if the hub dropped it), so release only sends. The WebSocket
+//   transport's socket is persistent on its own.
+
+void connectionService() {
+    if (wifiUp.load() || millis() - wifiLastAttempt < WIFI_RECONNECT_MS) return;
+    wifiLastAttempt = millis();
+    Serial.println("[WiFi] Down, reconnecting...");
+    WiFi.reconnect();
+}
+
+// Radio power mode: awake for a turn, modem sleep otherwise
+void linkSetActive(bool active) {
+#if WIFI_IDLE_MODEM_SLEEP
+    WiFi.setSleep(!active);
+#else
+    WiFi.setSleep(false);
+#endif
+}
+
+// Make sure the connection to the hub is open. Cheap when it already is.
+bool hubConnect() {
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    return webSocket.isConnected();
+#else
+    if (hubClient.connected()) return true;
+    if (!wifiUp.load()) return false;
+
+    hubClient.stop();
+    uint32_t startMs = millis();
+    if (!hubClient.connect(serverHost.c_str(), serverPort, HUB_CONNECT_TIMEOUT_MS)) {
+        Serial.printf("[NET] Could not connect to %s:%u\n", serverHost.c_str(), serverPort);
+        hubFailed();
+        return false;
+    }
+    hubClient.setNoDelay(true);  // Chunks and requests are already block-sized
+    statsHubConnects++;
+    Serial.printf("[NET] Hub connection open (%u ms)\n", (unsigned)(millis() - startMs));
+    return true;
+#endif
+}
+
+// ============================================================
+// BUTTON
+// ============================================================
+//
+// The PTT button is an any-edge GPIO interrupt. The first edge of a
+// bounce burst snapshots where capture is (and, for a press, arms the
+// capture task so frames are kept from that moment); every edge restarts
+// a BUTTON_DEBOUNCE_MS timer. When it expires the settled level is posted
+// to buttonQueue, with the snapshot, and loop() is woken. A burst that
+// settles back where it started posts nothing. (The S3's GPIO glitch
+// filter only removes nanosecond pulses, contact bounce needs the timer.)
+
+static void IRAM_ATTR onButtonEdge(void* arg) {
+    BaseType_t woken = pdFALSE;
+    if (idleAsleep) {
+        gpio_intr_disable((gpio_num_t)BUTTON_PIN);  // Level interrupt while asleep, once is enough
+        vTaskNotifyGiveFromISR(loopTaskHandle, &woken);
+    }
+    if (!buttonEdgePending) {
+        buttonEdgePending = true;
+        buttonEdge.ringPos      = captureRing.head.load(std::memory_order_acquire);
+        buttonEdge.captureReads = captureReads.load();
+        if (buttonStable == HIGH && gpio_get_level((gpio_num_t)BUTTON_PIN) == 0) {
+            captureArmed = true;
+        }
+    }
+    xTimerResetFromISR(buttonTimer, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Timer task: the level has held for BUTTON_DEBOUNCE_MS
+static void onButtonSettled(TimerHandle_t timer) {
+    int level = gpio_get_level((gpio_num_t)BUTTON_PIN);
+    buttonEdgePending = false;
+    if (level == buttonStable) {
+        if (level == HIGH) {
+            captureArmed = false;           // A glitch, not a press
+        }
+        return;
+    }
+    buttonStable = level;
+
+    ButtonEvent event;
+    event.type         = level == LOW ? BUTTON_PRESSED : BUTTON_RELEASED;
+    event.ringPos      = buttonEdge.ringPos;
+    event.captureReads = buttonEdge.captureReads;
+    xQueueSend(buttonQueue, &event, 0);
+    xTaskNotifyGive(loopTaskHandle);
+}
+
+void setupButton() {
+    loopTaskHandle = xTaskGetCurrentTaskHandle();   // setup() runs on the loop task
+    buttonQueue = xQueueCreate(8, sizeof(ButtonEvent));
+    buttonTimer = xTimerCreate("button", pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS), pdFALSE, nullptr, onButtonSettled);
+
+    gpio_set_intr_type((gpio_num_t)BUTTON_PIN, GPIO_INTR_ANYEDGE);
+    gpio_install_isr_service(0);    // ESP_ERR_INVALID_STATE if already installed, which is fine
+    gpio_isr_handler_add((gpio_num_t)BUTTON_PIN, onButtonEdge, nullptr);
+    gpio_intr_enable((gpio_num_t)BUTTON_PIN);
+    xTimerReset(buttonTimer, 0);    // Picks up a button already held at boot
+}
+
+// ============================================================
+// POWER MANAGEMENT
+// ============================================================
+//
+// Automatic light sleep is gated by pmAwakeLock (ESP_PM_CPU_FREQ_MAX):
+// while it's held the CPU runs at PM_MAX_FREQ_MHZ and never sleeps, so the
+// capture task, front end and WakeNet see no difference. powerSleep()
+// releases it once I2S (whose driver holds PM locks of its own while
+// enabled) is stopped. FreeRTOS then light-sleeps whenever every task is
+// blocked, and the WiFi driver wakes for beacons on its own.
+
+void setupPowerManagement() {
+    lastActiveMs = millis();
+#if IDLE_LIGHT_SLEEP
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "awake", &pmAwakeLock) != ESP_OK) {
+        Serial.println("[PM] Power management not in this build, idle uses modem sleep only");
+        return;
+    }
+    esp_pm_lock_acquire(pmAwakeLock);
+
+    esp_pm_config_t pm_config = {};
+    pm_config.max_freq_mhz       = PM_MAX_FREQ_MHZ;
+    pm_config.min_freq_mhz       = PM_MIN_FREQ_MHZ;
+    pm_config.light_sleep_enable = true;
+    esp_err_t result = esp_pm_configure(&pm_config);
+    if (result != ESP_OK) {
+        Serial.printf("[PM] Light sleep unavailable (%s), idle uses modem sleep only\n",
+                      esp_err_to_name(result));
+        return;
+    }
+
+    esp_sleep_enable_gpio_wakeup();     // The button, see powerSleep()
+    pmLightSleep = true;
+    Serial.printf("[PM] Light sleep after %u s idle, the button wakes\n", IDLE_SLEEP_AFTER_MS / 1000);
+#endif
+}
+
+void powerSleep() {
+    Serial.println("[PM] Idle, light sleep");
+    Serial.flush();
+    idleAsleep = true;
+    micPauseRequested = true;               // The capture task stops the mic
+    i2s_channel_disable(dacChannel);        // Playback is idle, auto_clear left it silent
+    WiFi.setSleep(WIFI_PS_MAX_MODEM);
+
+    // Edges aren't seen in light sleep: the button becomes a level
+    // interrupt (and wakeup source) until powerWake()
+    gpio_wakeup_enable((gpio_num_t)BUTTON_PIN, GPIO_INTR_LOW_LEVEL);
+    gpio_intr_enable((gpio_num_t)BUTTON_PIN);
+    esp_pm_lock_release(pmAwakeLock);
+}
+
+// Back to full speed. The mic is capturing again one DMA buffer
+// (MIC_DMA_FRAME_NUM samples) after this returns.
+void powerWake() {
+    if (!idleAsleep) return;
+    esp_pm_lock_acquire(pmAwakeLock);
+    gpio_wakeup_disable((gpio_num_t)BUTTON_PIN);
+    gpio_set_intr_type((gpio_num_t)BUTTON_PIN, GPIO_INTR_ANYEDGE);
+    gpio_intr_enable((gpio_num_t)BUTTON_PIN);
+    idleAsleep = false;
+    micPauseRequested = false;
+    xTaskNotifyGive(captureTaskHandle);
+    i2s_channel_enable(dacChannel);
+    linkSetActive(false);                   // Modem sleep between turns, as before sleeping
+    Serial.println("[PM] Awake");
+}
+
+// Called at the end of every loop(). Once idle for IDLE_SLEEP_AFTER_MS it
+// waits (asleep) for the button or IDLE_POLL_MS and returns true; loop()
+// skips its usual 10 ms wait then.
+bool powerService(bool idle) {
+#if IDLE_LIGHT_SLEEP
+    if (!pmLightSleep) return false;
+    if (!idle) {
+        powerWake();
+        lastActiveMs = millis();
+        return false;
+    }
+    if (!idleAsleep) {
+        if (millis() - lastActiveMs < IDLE_SLEEP_AFTER_MS) return false;
+        powerSleep();
+    }
+
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IDLE_POLL_MS)) > 0) {
+        powerWake();    // Before the press is debounced, so the mic is already starting
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+// ============================================================
+// TURN TIMING
+// ============================================================
+//
+// esp_timer timestamps of each milestone in a turn, measured from the
+// press (or the wake word). Each stage has a single writer (capture task,
+// playback task or loop()) and only its first hit counts. After the turn
+// the offsets are printed and reported to the hub with the turn ID, which
+// joins them with its own stage timings: over WebSocket as a telemetry
+// message, over HTTP as a header on the next request.
+
+enum TurnStage {
+    STAGE_PRESS,
+    STAGE_FIRST_SAMPLE,         // First frame captured for the turn
+    STAGE_UPLOAD_START,         // Uplink ready (connected, headers / start sent)
+    STAGE_UPLOAD_END,           // Last byte of the utterance sent
+    STAGE_FIRST_RESPONSE,       // First byte of the reply
+    STAGE_FIRST_DAC_WRITE,
+    STAGE_PLAYBACK_END,
+    STAGE_COUNT
+};
+
+const char* const TURN_STAGE_NAMES[STAGE_COUNT] = {
+    "press", "first_sample", "upload_start", "upload_end",
+    "first_response", "first_dac_write", "playback_end",
+};
+
+std::atomic<int64_t> turnStageUs[STAGE_COUNT];  // 0 = not reached this turn
+char     turnId[20] = "";                       // "<boot id>-<turn>", unique per satellite
+uint32_t turnBootId = 0;
+uint32_t turnSeq = 0;
+char     turnTimingHeader[192] = "";            // HTTP: last turn's report, sent with the next request
+
+void turnMark(TurnStage stage) {
+    if (turnStageUs[stage].load() == 0) {
+        turnStageUs[stage] = esp_timer_get_time();
+    }
+}
+
+void turnBegin() {
+    if (turnBootId == 0) {
+        turnBootId = esp_random() | 1;
+    }
+    for (auto& stage : turnStageUs) {
+        stage = 0;
+    }
+    snprintf(turnId, sizeof(turnId), "%08x-%u", (unsigned)turnBootId, (unsigned)++turnSeq);
+    turnMark(STAGE_PRESS);
+}
+
+// Reached stages as ms after the press: `first_sample=12;upload_start=40`
+// or, with json set, `"first_sample":12,"upload_start":40`
+size_t formatTurnStages(char* buf, size_t size, bool json) {
+    int64_t press = turnStageUs[STAGE_PRESS].load();
+    size_t n = 0;
+    buf[0] = '\0';
+
+    for (int i = STAGE_PRESS + 1; i < STAGE_COUNT && n < size; i++) {
+        int64_t at = turnStageUs[i].load();
+        if (at == 0) continue;
+        n += snprintf(buf + n, size - n, json ? "%s\"%s\":%u" : "%s%s=%u",
+                      n ? (json ? "," : ";") : "", TURN_STAGE_NAMES[i], (unsigned)((at - press) / 1000));
+    }
+    return min(n, size - 1);
+}
+
+// The turn is over (reply played): print the timings and report them
+void turnReport() {
+    char stages[160];
+    formatTurnStages(stages, sizeof(stages), false);
+    Serial.printf("[TIME] Turn %s: %s (ms)\n", turnId, stages);
+
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    char message[256];
+    int n = snprintf(message, sizeof(message), "{\"type\":\"telemetry\",\"turn_id\":\"%s\",\"stages\":{", turnId);
+    formatTurnStages(message + n, sizeof(message) - n - 2, true);
+    strcat(message, "}}");
+    if (webSocket.isConnected()) {
+        webSocket.sendTXT(message);
+    }
+#else
+    snprintf(turnTimingHeader, sizeof(turnTimingHeader), "id=%s;%s", turnId, stages);
+#endif
+}
+
+// ============================================================
+// METRICS
+// ============================================================
+//
+// Every STATS_INTERVAL_MS between turns the satellite reports its health
+// to the hub: over WebSocket as a "stats" message, for the HTTP
+// transports as a POST to /api/stats. Counters are totals since boot;
+// uptime_seconds going down tells the hub the satellite restarted.
+
+void statsReport() {
+    JsonDocument stats;
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    stats["type"] = "stats";
+#endif
+    stats["uptime_seconds"]      = (uint32_t)(esp_timer_get_time() / 1000000);
+    stats["rssi_dbm"]            = WiFi.RSSI();
+    stats["heap_free_bytes"]     = ESP.getFreeHeap();
+    stats["heap_min_free_bytes"] = ESP.getMinFreeHeap();
+    stats["psram_free_bytes"]    = ESP.getFreePsram();
+    stats["turns"]               = turnSeq;
+    stats["mic_overruns"]        = statsMicOverruns + micDmaOverruns.load();
+    stats["capture_drop_bytes"]  = statsCaptureDrops + captureRingDrops.load();
+    stats["playback_underruns"]  = statsPlayUnderruns.load();
+    stats["dac_underflows"]      = statsDacUnderflows.load();
+    stats["wifi_disconnects"]    = statsWifiDisconnects.load();
+    stats["hub_connects"]        = statsHubConnects;
+#if UPLINK_CODEC == CODEC_ADAPTIVE
+    stats["uplink_bytes_per_second"] = (uint32_t)uplinkLinkBps;
+#endif
+    String text;
+    serializeJson(stats, text);
+
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    if (webSocket.isConnected()) {
+        webSocket.sendTXT(text);
+    }
+#else
+    // Its own connection: hubClient stays ready for the next turn
+    HTTPClient http;
+    http.setConnectTimeout(HUB_PROBE_TIMEOUT_MS);   // Blocks loop(), like a hub probe
+    http.setTimeout(HUB_PROBE_TIMEOUT_MS);
+    http.begin(serverHost, serverPort, "/api/stats");
+    http.addHeader("Content-Type", "application/json");
+    http.addHeader("X-Satellite-ID", satelliteId);
+    int httpCode = http.POST(text);
+    http.end();
+    if (httpCode != 204) {
+        Serial.printf("[STATS] Report not taken by the hub: %d\n", httpCode);
+    }
+#endif
+}
+
+// Between turns: report when due, unless a press is coming in (the
+// report is then sent on a later pass)
+void statsService() {
+#if STATS_INTERVAL_MS
+    if (!wifiUp.load() || millis() - statsLastMs < STATS_INTERVAL_MS || hubBusy()) return;
+    statsLastMs = millis();
+    statsReport();
+#endif
+}
+
+// ============================================================
+// AUDIO PLAYBACK
+// ============================================================
+
+// The reply is played while it downloads: the network side writes PCM into
+// playbackRing, the playback task starts feeding the DAC once
+// PLAYBACK_PREBUFFER_MS are buffered and re-buffers if the ring runs dry.
+// Reply length is only bounded by the server, not by RAM.
+
+void playbackTask(void* param) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);  // Woken by startPlayback()
+
+        uint32_t startMs   = millis();
+        bool     buffering = true;
+        size_t   played    = 0;
+        uint32_t underruns = 0;
+
+        while (true) {
+#if BARGE_IN_ENABLED
+            if (playbackStop.load()) {
+                Serial.println("[PLAY] Interrupted");
+                break;
+            }
+#endif
+            size_t available = ringAvailable(&playbackRing);
+            bool   done      = playbackInputDone.load();
+
+            if (buffering) {
+                if (available < PLAYBACK_PREBUFFER_BYTES(playbackRate) && !done) {
+                    vTaskDelay(1);
+                    continue;
+                }
+                buffering = false;
+                if (played == 0) {
+                    Serial.printf("[PLAY] Started after %u ms\n", (unsigned)(millis() - startMs));
+                    dacDmaUnderruns = 0;    // The DAC idles on silence between replies
+                }
+            }
+
+            if (available < BYTES_PER_SAMPLE) {
+                if (done) break;
+                underruns++;        // Network fell behind, build the cushion up again
+                buffering = true;
+                continue;
+            }
+
+            // Written to the DAC straight from the ring. Whole samples only,
+            // the last odd byte waits for its partner.
+            size_t span = 0;
+            const uint8_t* pcm = ringReadSpan(&playbackRing, &span);
+            size_t len = min(span, (size_t)PLAYBACK_BLOCK_SIZE) & ~(size_t)(BYTES_PER_SAMPLE - 1);
+
+            size_t written = 0;
+            i2s_channel_write(dacChannel, pcm, len, &written, portMAX_DELAY);
+#if ECHO_CANCEL
+            if (echoCancelActive && playbackRate == SAMPLE_RATE) {
+                ringWrite(&echoRefRing, pcm, written);   // What the mic is about to hear
+            }
+#endif
+            ringConsume(&playbackRing, written);
+            played += written;
+            turnMark(STAGE_FIRST_DAC_WRITE);
+        }
+
+        if (playbackStop.load()) {
+            dacSilence();
+        } else {
+            // The last writes are still queued in the DMA, let them play out
+            vTaskDelay(pdMS_TO_TICKS(DAC_DMA_DESC_NUM * DAC_DMA_FRAME_NUM * 1000 / playbackRate) + 1);
+        }
+        turnMark(STAGE_PLAYBACK_END);
+
+        float durationSecs = (float)played / (playbackRate * BYTES_PER_SAMPLE);
+        lastPlayUnderruns  = underruns;
+        lastPlayUnderflows = dacDmaUnderruns.exchange(0);
+        statsPlayUnderruns += lastPlayUnderruns;
+        statsDacUnderflows += lastPlayUnderflows;
+        Serial.printf("[PLAY] Done. Played %.1f seconds (%u underruns, %u DMA underflows)\n",
+                      durationSecs, (unsigned)underruns, (unsigned)lastPlayUnderflows);
+
+        playbackRunning = false;
+    }
+}
+
+void startPlaybackTask() {
+    xTaskCreatePinnedToCore(playbackTask, "playback", PLAYBACK_TASK_STACK, nullptr,
+                            PLAYBACK_TASK_PRIORITY, &playbackTaskHandle, PLAYBACK_TASK_CORE);
+}
+
+// Called from the network side's waits while a reply is pending. A new
+// button press or the wake word stops the speaker and leaves the next turn
+// to loop(). True once barged in: the caller should stop waiting.
+bool bargeInPoll() {
+#if BARGE_IN_ENABLED
+    if (turnState < TURN_UPLOADING || bargeInPending) return bargeInPending;
+
+    // A release (of a press the VAD already ended) doesn't interrupt. A
+    // press stays queued, so loop() starts the next turn from its edge.
+    ButtonEvent event;
+    while (xQueuePeek(buttonQueue, &event, 0) == pdTRUE && event.type == BUTTON_RELEASED) {
+        xQueueReceive(buttonQueue, &event, 0);
+    }
+    bool pressed = xQueuePeek(buttonQueue, &event, 0) == pdTRUE;
+    if (!pressed && !wakeDetected.load()) return false;
+
+    Serial.println(pressed ? "[BARGE] Button pressed, stopping the reply"
+                           : "[BARGE] Wake word, stopping the reply");
+    bargeInPending = true;
+    playbackStop = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// The rates advertised to the hub
+const char* playbackRates() {
+    return echoCancelActive ? PLAYBACK_RATES_AEC : PLAYBACK_RATES;
+}
+
+// Called by the network side before the first PCM byte is written, with
+// the reply's sample rate. The DAC is re-clocked only when it changes.
+void startPlayback(uint32_t rate = SAMPLE_RATE) {
+    powerWake();   // Only asleep if the hub sends audio unprompted
+    if (turnState == TURN_UPLOADING) {
+        turnState = TURN_PLAYING;
+    }
+    if (rate != playbackRate) {
+        // The playback task is idle, so the DMA holds nothing but silence
+        i2s_std_clk_config_t clk_config = I2S_STD_CLK_DEFAULT_CONFIG(rate);
+        i2s_channel_disable(dacChannel);
+        esp_err_t result = i2s_channel_reconfig_std_clock(dacChannel, &clk_config);
+        i2s_channel_enable(dacChannel);
+        if (result == ESP_OK) {
+            playbackRate = rate;
+        } else {
+            Serial.printf("[PLAY] Can't clock the DAC at %u Hz, playing at %u Hz\n",
+                          (unsigned)rate, (unsigned)playbackRate);
+        }
+    }
+    ringReset(&playbackRing);  // Playback task is idle, nobody else touches the ring
+    playbackStop = false;
+    playbackInputDone = false;
+    playbackRunning = true;
+    xTaskNotifyGive(playbackTaskHandle);
+}
+
+// Called after the last PCM byte is written, returns when playback has finished
+void finishPlayback() {
+    playbackInputDone = true;
+    while (playbackRunning.load()) {
+        bargeInPoll();
+        delay(5);
+    }
+}
+
+// ============================================================
+// EARCONS
+// ============================================================
+//
+// Each sound is raw PCM in the playback format, one file per sound:
+// /earcons/<id>.<hash>.pcm. earconSync() fetches the hub's list (GET
+// /api/earcons), downloads what's new or changed and deletes what the hub
+// dropped. Over WebSocket the hub announces changes with {"type":"earcons"},
+// gets our inventory back, and sends {"type":"earcon","id":...} in place
+// of the audio for sounds we already have.
+
+#if EARCONS_ENABLED
+struct Earcon {
+    char     id[EARCON_ID_LEN];
+    char     hash[EARCON_HASH_LEN];
+    uint32_t size;
+};
+
+Earcon earcons[EARCON_MAX];
+int    earconCount       = 0;
+bool   earconsMounted    = false;
+bool   earconSyncPending = false;   // Set when the hub has a new set, synced once idle
+
+String earconPath(const char* id, const char* hash) {
+    return String(EARCON_DIR) + "/" + id + "." + hash + ".pcm";
+}
+
+// Rebuild the table from the file names in EARCON_DIR
+void earconsLoad() {
+    earconCount = 0;
+    File dir = LittleFS.open(EARCON_DIR);
+    if (!dir || !dir.isDirectory()) return;
+
+    for (File file = dir.openNextFile(); file && earconCount < EARCON_MAX; file = dir.openNextFile()) {
+        String name = file.name();
+        int slash = name.lastIndexOf('/');     // Older cores return the full path
+        if (slash >= 0) name = name.substring(slash + 1);
+        int hashDot = name.indexOf('.');
+        int extDot = name.lastIndexOf('.');
+        if (!name.endsWith(".pcm") || hashDot <= 0 || hashDot == extDot) continue;
+        if (hashDot >= EARCON_ID_LEN || extDot - hashDot > EARCON_HASH_LEN) continue;
+
+        Earcon& earcon = earcons[earconCount++];
+        snprintf(earcon.id, sizeof(earcon.id), "%s", name.substring(0, hashDot).c_str());
+        snprintf(earcon.hash, sizeof(earcon.hash), "%s", name.substring(hashDot + 1, extDot).c_str());
+        earcon.size = file.size();
+    }
+}
+
+void setupEarcons() {
+    earconsMounted = LittleFS.begin(true);     // Formats the partition on first boot
+    if (!earconsMounted) {
+        Serial.println("[EARCON] LittleFS mount failed, no local sounds.");
+        return;
+    }
+    LittleFS.mkdir(EARCON_DIR);
+    earconsLoad();
+    Serial.printf("[EARCON] %d sounds in flash, %u KB free\n", earconCount,
+                  (unsigned)((LittleFS.totalBytes() - LittleFS.usedBytes()) / 1024));
+}
+
+const Earcon* earconFind(const char* id) {
+    for (int i = 0; i < earconCount; i++) {
+        if (strcmp(earcons[i].id, id) == 0) return &earcons[i];
+    }
+    return nullptr;
+}
+
+// Queue an earcon behind a reply at another rate: linear interpolation,
+// stepping through the SAMPLE_RATE file in 16.16 fixed point
+void earconWriteResampled(File& file) {
+    const uint32_t step = ((uint32_t)SAMPLE_RATE << 16) / playbackRate;
+    int16_t  in[128];
+    int16_t  out[128];
+    size_t   inCount = 0;
+    size_t   inPos   = 0;
+    int32_t  samples[2];            // The input samples the output falls between
+    uint32_t phase   = 0;           // Position past samples[0]
+
+    for (int i = 0; i < 2; i++) {
+        if (inPos == inCount) {
+            inCount = file.read((uint8_t*)in, sizeof(in)) / BYTES_PER_SAMPLE;
+            inPos = 0;
+            if (inCount == 0) return;
+        }
+        samples[i] = in[inPos++];
+    }
+
+    bool more = true;
+    while (more && playbackRunning.load() && !bargeInPoll()) {
+        size_t count = 0;
+        while (count < sizeof(out) / sizeof(out[0]) && more) {
+            out[count++] = (int16_t)(samples[0] + (((int64_t)(samples[1] - samples[0]) * phase) >> 16));
+            for (phase += step; phase >= 0x10000 && more; phase -= 0x10000) {
+                if (inPos == inCount) {
+                    inCount = file.read((uint8_t*)in, sizeof(in)) / BYTES_PER_SAMPLE;
+                    inPos = 0;
+                    more = inCount > 0;
+                    if (!more) break;
+                }
+                samples[0] = samples[1];
+                samples[1] = in[inPos++];
+            }
+        }
+
+        const uint8_t* pcm = (const uint8_t*)out;
+        size_t len = count * BYTES_PER_SAMPLE;
+        while (len > 0 && playbackRunning.load() && !bargeInPoll()) {
+            size_t written = ringWrite(&playbackRing, pcm, len);
+            pcm += written;
+            len -= written;
+            if (len > 0) delay(1);  // Ring full, wait for the DAC
+        }
+    }
+}
+
+// Read an earcon from flash straight into the playback ring. Earcons are
+// stored at SAMPLE_RATE, during a reply at another rate they're converted.
+void earconWrite(const Earcon* earcon) {
+    File file = LittleFS.open(earconPath(earcon->id, earcon->hash), "r");
+    if (!file) return;
+
+    if (playbackRate != SAMPLE_RATE) {
+        earconWriteResampled(file);
+        file.close();
+        return;
+    }
+
+    while (playbackRunning.load() && !bargeInPoll()) {
+        size_t span = 0;
+        uint8_t* dst = ringWriteSpan(&playbackRing, &span);
+        if (span == 0) {
+            delay(1);               // Ring full, wait for the DAC
+            continue;
+        }
+        size_t got = file.read(dst, min(span, (size_t)PLAYBACK_BLOCK_SIZE));
+        if (got == 0) break;
+        ringCommit(&playbackRing, got);
+    }
+    file.close();
+}
+
+// Play a stored sound. During a reply it's queued behind the audio already
+// in the ring; otherwise it plays on its own and returns once it has.
+bool earconPlay(const char* id) {
+    const Earcon* earcon = earconFind(id);
+    if (!earcon) return false;
+
+    if (playbackRunning.load()) {
+        earconWrite(earcon);
+    } else {
+        startPlayback();
+        earconWrite(earcon);
+        finishPlayback();
+    }
+    return true;
+}
+
+// Tell the hub which sounds it can refer to
+void earconReport() {
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    if (!webSocket.isConnected()) return;
+
+    JsonDocument msg;
+    msg["type"] = "earcons";
+    JsonObject have = msg["have"].to<JsonObject>();
+    for (int i = 0; i < earconCount; i++) {
+        have[earcons[i].id] = earcons[i].hash;
+    }
+    String text;
+    serializeJson(msg, text);
+    webSocket.sendTXT(text);
+#endif
+}
+
+bool earconDownload(const char* id, const char* hash, uint32_t size) {
+    String partial = String(EARCON_DIR) + "/" + id + ".part";
+    HTTPClient http;
+    http.setConnectTimeout(EARCON_TIMEOUT_MS);
+    http.setTimeout(EARCON_TIMEOUT_MS);
+    http.begin(serverHost, serverPort, String("/api/earcons/") + id + "?hash=" + hash);
+
+    // A response of any other length than the list said is never stored
+    bool ok = false;
+    if (http.GET() == 200 && http.getSize() == (int)size) {
+        File file = LittleFS.open(partial, "w");
+        if (file) {
+            ok = http.writeToStream(&file) == (int)size;
+            file.close();
+        }
+    }
+    http.end();
+
+    if (ok) {
+        ok = LittleFS.rename(partial, earconPath(id, hash));
+    }
+    if (!ok) {
+        LittleFS.remove(partial);
+        Serial.printf("[EARCON] Could not download '%s'\n", id);
+    }
+    return ok;
+}
+
+// Bring flash in line with the hub's set. Requests block, so this only
+// runs between turns, and stops (leaving earconSyncPending set, to go on
+// from the new list on a later pass) as soon as a press comes in.
+void earconSync() {
+    if (hubBusy()) {
+        earconSyncPending = true;
+        return;
+    }
+    earconSyncPending = false;
+    if (!earconsMounted || !wifiUp.load()) return;
+
+    HTTPClient http;
+    http.setConnectTimeout(EARCON_TIMEOUT_MS);
+    http.setTimeout(EARCON_TIMEOUT_MS);
+    http.begin(serverHost, serverPort, "/api/earcons");
+    int httpCode = http.GET();
+    if (httpCode != 200) {
+        Serial.printf("[EARCON] Could not fetch the list from the hub: %d\n", httpCode);
+        http.end();
+        return;
+    }
+    JsonDocument manifest;
+    DeserializationError error = deserializeJson(manifest, http.getString());
+    http.end();
+    if (error) {
+        Serial.println("[EARCON] Malformed list from the hub");
+        return;
+    }
+    JsonArrayConst items = manifest["earcons"].as<JsonArrayConst>();
+
+    // Drop what the hub no longer has, or has replaced
+    int removed = 0;
+    for (int i = 0; i < earconCount; i++) {
+        bool current = false;
+        for (JsonObjectConst item : items) {
+            if (strcmp(item["id"] | "", earcons[i].id) == 0 && strcmp(item["hash"] | "", earcons[i].hash) == 0) {
+                current = true;
+                break;
+            }
+        }
+        if (!current) {
+            LittleFS.remove(earconPath(earcons[i].id, earcons[i].hash));
+            removed++;
+        }
+    }
+    earconsLoad();
+
+    int fetched = 0;
+    for (JsonObjectConst item : items) {
+        if (hubBusy()) {
+            earconSyncPending = true;
+            break;
+        }
+        const char* id   = item["id"] | "";
+        const char* hash = item["hash"] | "";
+        uint32_t    size = item["size"] | 0;
+        if (!id[0] || !hash[0] || strlen(id) >= EARCON_ID_LEN || strlen(hash) >= EARCON_HASH_LEN) continue;
+        if (earconFind(id)) continue;
+        if (earconCount + fetched >= EARCON_MAX) break;
+        if (LittleFS.totalBytes() - LittleFS.usedBytes() < size + EARCON_FS_RESERVE) {
+            Serial.println("[EARCON] Flash full, not downloading more.");
+            break;
+        }
+        if (earconDownload(id, hash, size)) fetched++;
+    }
+    earconsLoad();
+    if (earconSyncPending) {
+        Serial.printf("[EARCON] Sync paused for a turn (%d new so far)\n", fetched);
+        return;
+    }
+
+    Serial.printf("[EARCON] Synced: %d sounds (%d new, %d removed)\n", earconCount, fetched, removed);
+    earconReport();
+}
+#else
+bool earconPlay(const char* id) { return false; }
+#endif
+
+// ============================================================
+// HTTP SEND & RECEIVE
+// ============================================================
+
+// Read a chunk-size line ("1F40\r\n"), skipping the CRLF that ends the
+// previous chunk. Returns 0 for the last chunk (or a line that isn't one).
+size_t readChunkSize(WiFiClient* stream) {
+    String line = stream->readStringUntil('\n');
+    line.trim();
+    if (line.length() == 0) {
+        line = stream->readStringUntil('\n');
+        line.trim();
+    }
+    return strtoul(line.c_str(), nullptr, 16);
+}
+
+// Stream an audio/wav reply into the playback ring (responseLen -1 = read
+// until the server closes). Only what fits in the ring is taken off the
+// socket, so a fast server is held back by TCP flow control. A chunked
+// reply (the hub streaming TTS sentence by sentence) is de-chunked here.
+// A reply the DAC can't play (not 16-bit mono PCM) is skipped. Returns
+// false if the rest of the body was left unread (skipped, barge-in,
+// stall), so the caller mustn't reuse the connection.
+bool streamAudioResponse(WiFiClient* stream, int responseLen, bool chunked) {
+    if (responseLen >= 0) {
+        Serial.printf("[HTTP] Audio response: %d bytes\n", responseLen);
+    } else {
+        Serial.printf("[HTTP] Audio response (%s)\n", chunked ? "streamed" : "length unknown");
+    }
+
+    uint8_t  header[WAV_HEADER_SIZE];      // Only the sample rate is used, playback starts once it's in
+    size_t   received   = 0;
+    size_t   chunkLeft  = 0;               // Body bytes left in the current chunk
+    uint32_t lastData   = millis();
+    bool     complete   = false;
+
+    while (responseLen < 0 || received < (size_t)responseLen) {
+        if (bargeInPoll()) break;   // The caller drops the connection
+
+        int available = stream->available();
+        if (available <= 0) {
+            if (!stream->connected()) {
+                complete = responseLen < 0 && !chunked;   // Read until close
+                break;
+            }
+            if (millis() - lastData > HTTP_TIMEOUT_MS) {
+                Serial.println("[HTTP] Audio response stalled, giving up.");
+                break;
+            }
+            delay(1);
+            continue;
+        }
+
+        if (chunked && chunkLeft == 0) {
+            chunkLeft = readChunkSize(stream);
+            if (chunkLeft == 0) {          // Zero-length chunk ends the reply
+                stream->readStringUntil('\n');   // ... and the empty line after it
+                complete = true;
+                break;
+            }
+            lastData = millis();
+            continue;
+        }
+
+        // The header goes to its own buffer, PCM is read from the socket
+        // straight into the playback ring
+        size_t   want = PLAYBACK_BLOCK_SIZE;
+        uint8_t* dst  = header + received;
+        if (received < WAV_HEADER_SIZE) {
+            want = WAV_HEADER_SIZE - received;
+        } else {
+            dst = ringWriteSpan(&playbackRing, &want);
+            want = min(want, (size_t)PLAYBACK_BLOCK_SIZE);
+            if (want == 0) {
+                delay(1);           // Ring full, wait for the DAC to catch up
+                lastData = millis();
+                continue;
+            }
+        }
+        if (responseLen >= 0) {
+            want = min(want, (size_t)responseLen - received);
+        }
+        if (chunked) {
+            want = min(want, chunkLeft);
+        }
+
+        int got = stream->read(dst, min(want, (size_t)available));
+        if (got <= 0) continue;
+        if (received >= WAV_HEADER_SIZE) {
+            ringCommit(&playbackRing, got);
+        }
+        received += got;
+        if (received == WAV_HEADER_SIZE) {
+            uint32_t rate = replyWavRate(header);
+            if (rate == 0) {
+                Serial.printf("[HTTP] Reply isn't 16-bit mono PCM (format %u, %u ch, %u bit), skipping it\n",
+                              getLE16(header + 20), getLE16(header + 22), getLE16(header + 34));
+                earconPlay(EARCON_ERROR);
+                return false;
+            }
+            startPlayback(rate);
+        }
+        if (chunked) {
+            chunkLeft -= got;
+        }
+        lastData = millis();
+    }
+    if (responseLen >= 0 && received == (size_t)responseLen) {
+        complete = true;
+    }
+
+    finishPlayback();
+    return complete;
+}
+
+#if TRANSPORT == TRANSPORT_HTTP_BUFFERED
+// Buffered mode: POST the whole recording from audioBuffer after release
+void sendAudioToServer() {
+    if (WiFi.status() != WL_CONNECTED) {
+        Serial.println("[HTTP] WiFi not connected, skipping send.");
+        earconPlay(EARCON_ERROR);
+        return;
+    }
+
+    size_t totalSize = audioBufferPos;  // WAV header + audio data
+    Serial.printf("[HTTP] Sending %d bytes to %s:%u\n", totalSize, serverHost.c_str(), serverPort);
+
+    // Blink LED rapidly to indicate "processing"
+    digitalWrite(LED_PIN, HIGH);
+
+    // Normally already open since the button press; HTTPClient reuses it
+    // and keeps it open afterwards if the hub allows keep-alive
+    hubConnect();
+    HTTPClient http;
+    http.begin(hubClient, serverHost, serverPort, serverPath);
+    http.setReuse(true);
+    http.addHeader("Content-Type", "audio/wav");
+    http.addHeader("X-Satellite-ID", satelliteId);
+    http.addHeader("X-Playback-Rates", playbackRates());
+    http.addHeader("X-Turn-ID", turnId);
+    if (turnTimingHeader[0]) {
+        http.addHeader("X-Prev-Turn-Timing", turnTimingHeader);
+        turnTimingHeader[0] = '\0';
+    }
+    http.setTimeout(HTTP_TIMEOUT_MS);
+
+    const char* responseHeaders[] = { "Content-Type", "Transfer-Encoding", "X-Processing-Time" };
+    http.collectHeaders(responseHeaders, 3);
+
+    // POST() returns with the reply, so upload end isn't seen separately
+    turnMark(STAGE_UPLOAD_START);
+    int httpCode = http.POST(audioBuffer, totalSize);
+    turnMark(STAGE_FIRST_RESPONSE);
+
+    if (httpCode == 200) {
+        Serial.printf("[HTTP] Response received: %d\n", httpCode);
+
+        // Until the reply headers minus the hub's STT time is the upload
+        int64_t postUs = turnStageUs[STAGE_FIRST_RESPONSE].load() - turnStageUs[STAGE_UPLOAD_START].load();
+        int64_t hubUs  = (int64_t)(http.header("X-Processing-Time").toFloat() * 1e6f);
+        uplinkMeasure(totalSize, max(postUs - hubUs, (int64_t)1000), true,
+                      (float)recordedBytes / (SAMPLE_RATE * BYTES_PER_SAMPLE));
+
+        String contentType = http.header("Content-Type");
+        bool chunked = http.header("Transfer-Encoding").equalsIgnoreCase("chunked");
+        int responseLen = http.getSize();
+
+        if (contentType.startsWith("audio/wav") && (responseLen < 0 || responseLen > WAV_HEADER_SIZE)) {
+            // Response is audio — play it through the speaker as it arrives.
+            // The raw stream still has the chunk framing, HTTPClient only
+            // strips it in getString()/writeToStream().
+            if (!streamAudioResponse(http.getStreamPtr(), responseLen, chunked)) {
+                hubClient.stop();   // Rest of the reply is unread, don't reuse the socket
+            }
+        } else {
+            // Response is JSON or text — print it to serial (e.g. transcription result)
+            String body = http.getString();
+            Serial.println("[HTTP] Server response:");
+            Serial.println(body);
+        }
+    } else {
+        Serial.printf("[HTTP] Error: %d - %s\n", httpCode, http.errorToString(httpCode).c_str());
+        if (httpCode < 0 || httpCode >= 500) hubFailed();
+        earconPlay(EARCON_ERROR);
+    }
+
+    http.end();
+    digitalWrite(LED_PIN, LOW);
+}
+#endif
+
+// ============================================================
+// HTTP STREAMING UPLOAD
+// ============================================================
+//
+// HTTPClient can only POST a body of known length, so streaming mode talks
+// HTTP/1.1 over a plain WiFiClient: the request headers go out on button
+// press, every captured block is sent as one chunk while the button is
+// held, and release only has to send the terminating zero-length chunk.
+
+// Write one chunk of the request body. The CRLF that closes a chunk is sent
+// together with the next chunk's size line, so each chunk costs two writes.
+bool writeUploadChunk(const uint8_t* data, size_t len) {
+    char sizeLine[16];
+    int n = snprintf(sizeLine, sizeof(sizeLine), "%s%X\r\n",
+                     uploadFirstChunk ? "" : "\r\n", (unsigned)len);
+    uploadFirstChunk = false;
+
+    if (hubClient.write((const uint8_t*)sizeLine, n) != (size_t)n) return false;
+    if (len == 0) {
+        // Last chunk: "0\r\n" followed by the empty trailer line
+        return hubClient.write((const uint8_t*)"\r\n", 2) == 2;
+    }
+    return hubClient.write(data, len) == len;
+}
+
+// Close the socket and forget the in-flight upload
+void abortStreamUpload() {
+    if (uploadActive) {
+        Serial.println("[HTTP] Upload aborted.");
+    }
+    hubClient.stop();
+    uploadActive = false;
+}
+
+// Send captured audio to the server as one chunk
+void streamAudioChunk(const uint8_t* data, size_t len) {
+    if (!uploadActive) return;
+
+    if (!writeUploadChunk(data, len)) {
+        Serial.println("[HTTP] Write failed, connection lost.");
+        abortStreamUpload();
+    }
+}
+
+// Open the connection and send the request line, headers and WAV header
+void beginStreamUpload() {
+    uploadActive = false;
+    uploadFirstChunk = true;
+
+    if (WiFi.status() != WL_CONNECTED) {
+        Serial.println("[HTTP] WiFi not connected, recording without upload.");
+        return;
+    }
+
+    if (!hubConnect()) {
+        return;
+    }
+
+    hubClient.printf(
+        "POST %s HTTP/1.1\r\n"
+        "Host: %s:%u\r\n"
+        "Content-Type: audio/wav\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "X-Satellite-ID: %s\r\n"
+        "X-Playback-Rates: %s\r\n"
+        "X-Turn-ID: %s\r\n",
+        serverPath.c_str(), serverHost.c_str(), serverPort, satelliteId, playbackRates(), turnId);
+    if (turnTimingHeader[0]) {
+        hubClient.printf("X-Prev-Turn-Timing: %s\r\n", turnTimingHeader);
+        turnTimingHeader[0] = '\0';
+    }
+    hubClient.print("Connection: close\r\n\r\n");
+    uploadActive = true;
+
+    // Length is unknown until release, the server counts the bytes itself
+    uint8_t header[ADPCM_WAV_HEADER_SIZE];
+    size_t headerSize = writeUplinkWavHeader(header);
+    streamAudioChunk(header, headerSize);
+    turnMark(STAGE_UPLOAD_START);
+
+    Serial.printf("[HTTP] Streaming to %s:%u%s\n", serverHost.c_str(), serverPort, serverPath.c_str());
+}
+
+// Read the status line and headers of the reply.
+// Returns the HTTP status code, or -1 if the server never answered (or
+// the user barged in while waiting).
+int readResponseHead(WiFiClient& client, String& contentType, int& contentLength, bool& chunked) {
+    contentType = "";
+    contentLength = -1;
+    chunked = false;
+
+    uint32_t waitStart = millis();
+    while (!client.available()) {
+        if (!client.connected() || millis() - waitStart > HTTP_TIMEOUT_MS || bargeInPoll()) {
+            return -1;
+        }
+        delay(1);
+    }
+    turnMark(STAGE_FIRST_RESPONSE);
+
+    String statusLine = client.readStringUntil('\n');  // "HTTP/1.1 200 OK"
+    int code = statusLine.substring(9, 12).toInt();
+
+    while (true) {
+        String line = client.readStringUntil('\n');
+        line.trim();
+        if (line.length() == 0) break;  // Blank line ends the headers
+
+        int colon = line.indexOf(':');
+        if (colon < 0) continue;
+
+        String name = line.substring(0, colon);
+        String value = line.substring(colon + 1);
+        name.toLowerCase();
+        value.trim();
+
+        if (name == "content-type") {
+            contentType = value;
+        } else if (name == "content-length") {
+            contentLength = value.toInt();
+        } else if (name == "transfer-encoding") {
+            chunked = value.equalsIgnoreCase("chunked");
+        }
+    }
+    return code;
+}
+
+// Read a text reply body (until Content-Length, the last chunk of a
+// chunked reply, or until the server closes)
+String readResponseText(WiFiClient& client, int contentLength, bool chunked) {
+    String body;
+    size_t chunkLeft = 0;
+    uint32_t lastData = millis();
+
+    while (chunked || contentLength < 0 || (int)body.length() < contentLength) {
+        if (client.available()) {
+            if (chunked && chunkLeft == 0) {
+                chunkLeft = readChunkSize(&client);
+                if (chunkLeft == 0) break;     // Zero-length chunk ends the reply
+            } else {
+                body += (char)client.read();
+                if (chunked) chunkLeft--;
+            }
+            lastData = millis();
+        } else if (!client.connected() || millis() - lastData > HTTP_TIMEOUT_MS) {
+            break;
+        } else {
+            delay(1);
+        }
+    }
+    return body;
+}
+
+// Streaming mode: end the request body and handle the server's reply
+void finishStreamUpload() {
+    if (!uploadActive) {
+        Serial.println("[HTTP] No upload in progress, nothing sent.");
+        hubClient.stop();
+        earconPlay(EARCON_ERROR);
+        return;
+    }
+
+    // Blink LED rapidly to indicate "processing"
+    digitalWrite(LED_PIN, HIGH);
+
+    if (!writeUploadChunk(nullptr, 0)) {
+        Serial.println("[HTTP] Write failed, connection lost.");
+        abortStreamUpload();
+        digitalWrite(LED_PIN, LOW);
+        hubFailed();
+        earconPlay(EARCON_ERROR);
+        return;
+    }
+    turnMark(STAGE_UPLOAD_END);
+    Serial.printf("[HTTP] Upload complete (%u bytes)\n", (unsigned)uplinkBytes);
+
+    String contentType;
+    int responseLen;
+    bool chunked;
+    int httpCode = readResponseHead(hubClient, contentType, responseLen, chunked);
+
+    if (bargeInPending) {
+        // Interrupted before the reply came, closing the socket below drops it
+    } else if (httpCode == 200) {
+        Serial.printf("[HTTP] Response received: %d\n", httpCode);
+
+        if (contentType.startsWith("audio/wav") && (responseLen < 0 || responseLen > WAV_HEADER_SIZE)) {
+            streamAudioResponse(&hubClient, responseLen, chunked);
+        } else {
+            String body = readResponseText(hubClient, responseLen, chunked);
+            Serial.println("[HTTP] Server response:");
+            Serial.println(body);
+        }
+    } else if (httpCode < 0) {
+        Serial.println("[HTTP] Error: no response from server");
+        hubFailed();
+        earconPlay(EARCON_ERROR);
+    } else {
+        Serial.printf("[HTTP] Error: %d\n", httpCode);
+        if (httpCode >= 500) hubFailed();
+        earconPlay(EARCON_ERROR);
+    }
+
+    hubClient.stop();
+    uploadActive = false;
+    digitalWrite(LED_PIN, LOW);
+}
+
+// ============================================================
+// WEBSOCKET TRANSPORT
+// ============================================================
+//
+// One connection to the hub stays open across turns, so a turn costs no
+// TCP or HTTP setup. Binary frames are raw PCM (up while recording, down
+// while the reply plays), text frames are small JSON control messages:
+//
+//   satellite -> hub:  {"type":"start",...}  PCM...  {"type":"end"} | {"type":"cancel"}
+//   hub -> satellite:  {"type":"audio_start"}  PCM...  {"type":"audio_end"}
+//                      {"type":"result",...}   (ends the turn, same fields as the HTTP reply)
+//                      {"type":"error","message":"..."}
+//                      {"type":"earcon","id":"..."}   (play a stored sound, see EARCONS)
+//                      {"type":"earcons"}             (stored sounds changed, sync)
+
+// Copy reply audio into the playback ring, waiting for the DAC when it's
+// full. Blocking here stops webSocket.loop() reading, which lets TCP
+// back-pressure the server.
+void writePlaybackAudio(const uint8_t* data, size_t len) {
+    while (len > 0 && playbackRunning.load() && !bargeInPoll()) {
+        size_t written = ringWrite(&playbackRing, data, len);
+        data += written;
+        len -= written;
+        if (len > 0) delay(1);
+    }
+}
+
+void handleWsControl(const char* text, size_t len) {
+    JsonDocument msg;
+    if (deserializeJson(msg, text, len)) {
+        Serial.println("[WS] Ignoring malformed control message");
+        return;
+    }
+
+    const char* type = msg["type"] | "";
+
+    // Late messages about a reply the user barged in on
+    const char* forTurn = msg["turn_id"] | "";
+    if (forTurn[0] && strcmp(forTurn, wsBargedTurnId) == 0) return;
+
+    if (strcmp(type, "audio_start") == 0) {
+        uint32_t rate = msg["sample_rate"] | SAMPLE_RATE;
+        Serial.printf("[WS] Audio response (streamed, %u Hz)\n", (unsigned)rate);
+        startPlayback(rate);
+        wsPlaying = true;
+    } else if (strcmp(type, "audio_end") == 0) {
+        if (wsPlaying) {
+            wsPlaying = false;
+            finishPlayback();
+        }
+    } else if (strcmp(type, "result") == 0) {
+        Serial.println("[WS] Server response:");
+        Serial.write((const uint8_t*)text, len);
+        Serial.println();
+        wsReplyDone = true;
+    } else if (strcmp(type, "error") == 0) {
+        Serial.printf("[WS] Server error: %s\n", (const char*)(msg["message"] | "unknown"));
+        wsReplyDone = true;
+        earconPlay(EARCON_ERROR);
+    } else if (strcmp(type, "earcon") == 0) {
+        const char* id = msg["id"] | "";
+        if (!earconPlay(id)) {
+            Serial.printf("[WS] Hub referred to unknown sound '%s'\n", id);
+        }
+#if EARCONS_ENABLED
+    } else if (strcmp(type, "earcons") == 0) {
+        earconSyncPending = true;
+#endif
+    }
+}
+
+void onWebSocketEvent(WStype_t type, uint8_t* payload, size_t length) {
+    wsLastActivity = millis();
+
+    switch (type) {
+        case WStype_CONNECTED:
+            Serial.printf("[WS] Connected to %s:%u%s\n", serverHost.c_str(), serverPort, WS_PATH);
+            statsHubConnects++;
+            break;
+        case WStype_DISCONNECTED:
+            Serial.println("[WS] Disconnected");
+            wsTurnActive = false;
+            wsReplyDone = true;     // Nothing more is coming for this turn
+            break;
+        case WStype_TEXT:
+            if (!wsReplyDone) turnMark(STAGE_FIRST_RESPONSE);
+            handleWsControl((const char*)payload, length);
+            break;
+        case WStype_BIN:
+            if (!wsReplyDone) turnMark(STAGE_FIRST_RESPONSE);
+            if (wsPlaying) {
+                writePlaybackAudio(payload, length);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void connectWebSocket() {
+    webSocket.begin(serverHost.c_str(), serverPort, WS_PATH);
+    // Kept in a global: the library sends it again on every reconnect
+    wsExtraHeaders = String("X-Satellite-ID: ") + satelliteId + "\r\nX-Playback-Rates: " + playbackRates();
+    webSocket.setExtraHeaders(wsExtraHeaders.c_str());
+    webSocket.onEvent(onWebSocketEvent);
+    webSocket.setReconnectInterval(WS_RECONNECT_MS);
+    webSocket.enableHeartbeat(15000, 3000, 2);  // Ping every 15s, drop after 2 missed pongs
+}
+
+void wsBeginTurn() {
+    wsTurnActive = false;
+
+    if (!webSocket.isConnected()) {
+        Serial.println("[WS] Not connected, recording without upload.");
+        return;
+    }
+
+    char start[256];
+    if (uplinkCodec == CODEC_IMA_ADPCM) {
+        snprintf(start, sizeof(start),
+                 "{\"type\":\"start\",\"turn_id\":\"%s\",\"codec\":\"ima_adpcm\",\"sample_rate\":%d,\"channels\":%d,"
+                 "\"block_align\":%d,\"samples_per_block\":%d}",
+                 turnId, (int)uplinkRate, CHANNELS, ADPCM_BLOCK_SIZE, ADPCM_SAMPLES_PER_BLOCK);
+    } else {
+        snprintf(start, sizeof(start),
+                 "{\"type\":\"start\",\"turn_id\":\"%s\",\"codec\":\"pcm\",\"sample_rate\":%d,\"bits_per_sample\":%d,\"channels\":%d}",
+                 turnId, (int)uplinkRate, BITS_PER_SAMPLE, CHANNELS);
+    }
+    wsTurnActive = webSocket.sendTXT(start);
+    if (wsTurnActive) turnMark(STAGE_UPLOAD_START);
+}
+
+void wsSendAudio(const uint8_t* data, size_t len) {
+    if (!wsTurnActive) return;
+
+    if (!webSocket.sendBIN(data, len)) {
+        Serial.println("[WS] Send failed, connection lost.");
+        wsTurnActive = false;
+    }
+}
+
+void wsCancelTurn() {
+    if (wsTurnActive) {
+        webSocket.sendTXT("{\"type\":\"cancel\"}");
+    }
+    wsTurnActive = false;
+}
+
+// End the utterance and service the socket until the server has replied
+void wsFinishTurn() {
+    if (!wsTurnActive) {
+        Serial.println("[WS] No upload in progress, nothing sent.");
+        earconPlay(EARCON_ERROR);
+        return;
+    }
+
+    // Blink LED rapidly to indicate "processing"
+    digitalWrite(LED_PIN, HIGH);
+
+    wsReplyDone = false;
+    wsLastActivity = millis();
+    webSocket.sendTXT("{\"type\":\"end\"}");
+    wsTurnActive = false;
+    turnMark(STAGE_UPLOAD_END);
+    Serial.printf("[WS] Upload complete (%u bytes)\n", (unsigned)uplinkBytes);
+
+    while (!wsReplyDone && millis() - wsLastActivity < HTTP_TIMEOUT_MS) {
+        webSocket.loop();
+        if (bargeInPoll()) break;
+        delay(1);
+    }
+    if (bargeInPending) {
+        webSocket.sendTXT("{\"type\":\"cancel\"}");    // Hub stops the reply
+        snprintf(wsBargedTurnId, sizeof(wsBargedTurnId), "%s", turnId);
+    } else if (!wsReplyDone) {
+        Serial.println("[WS] Error: no response from server");
+        hubFailed();
+        earconPlay(EARCON_ERROR);
+    }
+
+    if (wsPlaying) {
+        wsPlaying = false;
+        finishPlayback();
+    }
+    digitalWrite(LED_PIN, LOW);
+}
+
+// ============================================================
+// UPLINK
+// ============================================================
+//
+// Per-turn entry points used by the recording code. Captured PCM is
+// decimated to uplinkRate and encoded with uplinkCodec here, then handed
+// to the TRANSPORT.
+
+void transportSend(const uint8_t* data, size_t len) {
+    uplinkBytes += len;
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    wsSendAudio(data, len);
+#elif TRANSPORT == TRANSPORT_HTTP_STREAM
+    streamAudioChunk(data, len);
+#else
+    memcpy(audioBuffer + audioBufferPos, data, len);
+    audioBufferPos += len;
+#endif
+}
+
+void uplinkBegin() {
+    uplinkPick();
+    uplinkBytes = 0;
+    adpcmReset(&adpcmEncoder);
+    decimatorReset(&uplinkDecimator);
+#if TRANSPORT == TRANSPORT_HTTP_BUFFERED
+    audioBufferPos = uplinkHeaderSize();  // Room for the header, written after recording
+#endif
+
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    wsBeginTurn();
+#elif TRANSPORT == TRANSPORT_HTTP_STREAM
+    beginStreamUpload();
+#endif
+}
+
+// Send one block of captured 16-bit PCM (at most I2S_READ_BUF_SIZE), read
+// in place from the capture ring
+void uplinkSend(const uint8_t* pcm, size_t len) {
+    static int16_t decimated[I2S_READ_BUF_SIZE / BYTES_PER_SAMPLE / 2 + 1];
+    const int16_t* samples = (const int16_t*)pcm;
+    size_t count = len / BYTES_PER_SAMPLE;
+    if (uplinkRate != SAMPLE_RATE) {
+        count = decimate(&uplinkDecimator, samples, count, decimated);
+        samples = decimated;
+    }
+
+    if (uplinkCodec == CODEC_IMA_ADPCM) {
+        adpcmEncode(&adpcmEncoder, samples, count, transportSend);
+    } else {
+        transportSend((const uint8_t*)samples, count * BYTES_PER_SAMPLE);
+    }
+}
+
+// Button released: everything is sent, wait for and handle the reply
+void uplinkFinish() {
+    if (uplinkCodec == CODEC_IMA_ADPCM) {
+        adpcmFlush(&adpcmEncoder, transportSend);
+    }
+
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    wsFinishTurn();
+#elif TRANSPORT == TRANSPORT_HTTP_STREAM
+    finishStreamUpload();
+#else
+    writeUplinkWavHeader(audioBuffer, uplinkBytes);  // In front of the audio, now that its size is known
+    sendAudioToServer();
+#endif
+}
+
+// Recording too short: drop what was already sent
+void uplinkCancel() {
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    wsCancelTurn();
+#elif TRANSPORT == TRANSPORT_HTTP_STREAM
+    abortStreamUpload();
+#endif
+}
+
+// ============================================================
+// AUDIO FRONT END
+// ============================================================
+//
+// Runs on the capture task for every frame, recording or not, so the
+// filters are settled and the AGC gain tracks the room before a turn
+// starts. Both filters are biquads in ESP-DSP's layout ({b0, b1, b2, a1,
+// a2} with a 2-element delay line), so dsps_biquad_f32 runs them on the
+// S3 and the fallback below is the same direct form II.
+
+struct FrontEnd {
+    float dcCoef[5];
+    float dcState[2]  = {0, 0};
+    float hpfCoef[5];
+    float hpfState[2] = {0, 0};
+    float gain        = 1.0f;   // AGC gain, kept across turns
+};
+
+FrontEnd frontEnd;
+alignas(16) static float frontEndBuf[I2S_READ_BUF_SIZE / BYTES_PER_SAMPLE];
+alignas(16) static float frontEndTmp[I2S_READ_BUF_SIZE / BYTES_PER_SAMPLE];
+
+void frontEndInit() {
+    // DC blocker: H(z) = (1 - z^-1) / (1 - R z^-1)
+    const float dc[5] = {1.0f, -1.0f, 0.0f, -FRONTEND_DC_POLE, 0.0f};
+    memcpy(frontEnd.dcCoef, dc, sizeof(dc));
+
+    // RBJ high-pass
+    float w0 = 2.0f * PI * FRONTEND_HPF_HZ / SAMPLE_RATE;
+    float c = cosf(w0);
+    float alpha = sinf(w0) / (2.0f * FRONTEND_HPF_Q);
+    float a0 = 1.0f + alpha;
+    frontEnd.hpfCoef[0] = (1.0f + c) / 2.0f / a0;
+    frontEnd.hpfCoef[1] = -(1.0f + c) / a0;
+    frontEnd.hpfCoef[2] = (1.0f + c) / 2.0f / a0;
+    frontEnd.hpfCoef[3] = -2.0f * c / a0;
+    frontEnd.hpfCoef[4] = (1.0f - alpha) / a0;
+}
+
+void frontEndBiquad(const float* in, float* out, size_t count, const float* coef, float* w) {
+#ifdef HAVE_ESP_DSP
+    dsps_biquad_f32(in, out, count, (float*)coef, w);
+#else
+    for (size_t i = 0; i < count; i++) {
+        float d = in[i] - coef[3] * w[0] - coef[4] * w[1];
+        out[i] = coef[0] * d + coef[1] * w[0] + coef[2] * w[1];
+        w[1] = w[0];
+        w[0] = d;
+    }
+#endif
+}
+
+float frontEndEnergy(const float* x, size_t count) {
+    float energy = 0;
+#ifdef HAVE_ESP_DSP
+    dsps_dotprod_f32(x, x, &energy, count);
+#else
+    for (size_t i = 0; i < count; i++) {
+        energy += x[i] * x[i];
+    }
+#endif
+    return energy;
+}
+
+// Capture task: filter one frame of 16-bit samples in place
+void frontEndProcess(int16_t* samples, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        frontEndBuf[i] = samples[i];
+    }
+
+    frontEndBiquad(frontEndBuf, frontEndTmp, count, frontEnd.dcCoef, frontEnd.dcState);
+    frontEndBiquad(frontEndTmp, frontEndBuf, count, frontEnd.hpfCoef, frontEnd.hpfState);
+
+    float gain = frontEnd.gain;
+    float target = gain;
+#if AGC_ENABLED
+    // Move the gain toward the speech target, only on frames loud enough to
+    // be speech so silence doesn't get pumped up to the target level
+    float rms = sqrtf(frontEndEnergy(frontEndBuf, count) / count);
+    if (rms > AGC_GATE_RMS) {
+        float wanted = constrain(AGC_TARGET_RMS / rms, AGC_MIN_GAIN, AGC_MAX_GAIN);
+        target += (wanted - target) * (wanted < target ? AGC_ATTACK : AGC_RELEASE);
+    }
+#endif
+
+    // Apply the gain, ramped across the frame so changes don't click
+    float step = (target - gain) / count;
+    for (size_t i = 0; i < count; i++) {
+        float v = frontEndBuf[i] * gain;
+        gain += step;
+        samples[i] = (int16_t)constrain(v, -32768.0f, 32767.0f);
+    }
+    frontEnd.gain = target;
+}
+
+// ============================================================
+// VOICE ACTIVITY DETECTION
+// ============================================================
+//
+// Runs on loop() over frames waiting in the capture ring, ahead of the
+// uplink. Frames up to VAD_TAIL_MS past the last speech frame are sent;
+// anything later is held in the ring until speech resumes (then it's sent
+// too, as the pause) or it's more than VAD_PREROLL_MS old (then dropped).
+// Before the first speech this trims the lead-in, after the last speech
+// it trims the tail, and in between it shortens long pauses.
+
+struct VadState {
+    float    noiseRms   = VAD_INITIAL_NOISE;  // Adaptive noise floor, kept across turns
+    size_t   scanPos    = 0;      // Ring position up to which frames are classified
+    size_t   sendLimit  = 0;      // Ring position up to which audio gets sent
+    size_t   armPos     = 0;      // Speech before this ring position doesn't count
+    uint32_t endSilenceMs = 0;    // Auto-end after this much silence (0 = off)
+    bool     speechSeen = false;  // Speech onset detected this turn
+    uint32_t speechRun  = 0;      // Consecutive speech frames
+    uint32_t silenceRun = 0;      // Consecutive non-speech frames
+};
+
+VadState vad;
+
+// Is this frame speech? Also tracks the noise floor on non-speech frames.
+bool vadClassifyFrame(const int16_t* samples, size_t count) {
+    int64_t sum = 0, sumSq = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum   += samples[i];
+        sumSq += (int32_t)samples[i] * samples[i];
+    }
+
+    // RMS and zero crossings around the frame mean, so mic DC offset doesn't count
+    float mean = (float)sum / count;
+    float variance = (float)sumSq / count - mean * mean;
+    float rms = sqrtf(variance > 0 ? variance : 0);
+
+    int   crossings = 0;
+    bool  above = samples[0] > mean;
+    for (size_t i = 1; i < count; i++) {
+        bool a = samples[i] > mean;
+        crossings += (a != above);
+        above = a;
+    }
+    float zcr = (float)crossings / count;
+
+    bool voiced   = rms > vad.noiseRms * VAD_SPEECH_RATIO;
+    bool unvoiced = rms > vad.noiseRms * VAD_FRICATIVE_RATIO && zcr > VAD_FRICATIVE_ZCR;
+    bool speech   = (voiced || unvoiced) && rms > VAD_MIN_RMS;
+
+    // Follow the noise floor quickly on silence, barely during speech
+    vad.noiseRms += (rms - vad.noiseRms) * (speech ? 0.001f : 0.05f);
+    return speech;
+}
+
+// Start of a turn. Classification starts at the ring's read position;
+// `armPos` lets a wake turn ignore the wake word itself in its pre-roll.
+void vadBegin(uint32_t endSilenceMs, size_t armPos) {
+    vad.scanPos = captureRing.tail.load();
+    vad.sendLimit = vad.scanPos;
+    vad.armPos = armPos;
+    vad.endSilenceMs = endSilenceMs;
+    vad.speechSeen = false;
+    vad.speechRun = 0;
+    vad.silenceRun = 0;
+}
+
+// Classify the frames the capture task added since the last call
+void vadScan() {
+    while ((size_t)(captureRing.head.load(std::memory_order_acquire) - vad.scanPos) >= I2S_READ_BUF_SIZE) {
+        // Frames are committed whole and never wrap, so each one is contiguous
+        const int16_t* frame = (const int16_t*)(captureRing.buf + (vad.scanPos & (captureRing.size - 1)));
+        vad.scanPos += I2S_READ_BUF_SIZE;
+
+        if (vadClassifyFrame(frame, I2S_READ_BUF_SIZE / BYTES_PER_SAMPLE)) {
+            vad.silenceRun = 0;
+            if (++vad.speechRun >= VAD_ONSET_FRAMES && (int32_t)(vad.scanPos - vad.armPos) > 0) {
+                if (!vad.speechSeen) {
+                    Serial.println("[VAD] Speech detected");
+                }
+                vad.speechSeen = true;
+                vad.sendLimit = vad.scanPos + VAD_TAIL_BYTES;
+            }
+        } else {
+            vad.speechRun = 0;
+            vad.silenceRun++;
+        }
+    }
+}
+
+// Bytes at the read position that are cleared for sending
+size_t vadSendableBytes() {
+    size_t tail = captureRing.tail.load();
+    size_t limit = vad.sendLimit;
+    if ((int32_t)(vad.scanPos - limit) < 0) {
+        limit = vad.scanPos;  // Tail window not captured yet
+    }
+    return (int32_t)(limit - tail) > 0 ? limit - tail : 0;
+}
+
+// Nothing is sendable: drop held frames beyond the pre-roll window
+void vadDropHeld() {
+    size_t held = vad.scanPos - captureRing.tail.load();
+    if (held > VAD_PREROLL_BYTES) {
+        ringConsume(&captureRing, held - VAD_PREROLL_BYTES);
+    }
+}
+
+// Speaker has gone quiet for the turn's end silence after saying something
+bool vadUtteranceEnded() {
+    return vad.endSilenceMs > 0 && vad.speechSeen &&
+           vad.silenceRun * VAD_FRAME_MS >= vad.endSilenceMs;
+}
+
+// ============================================================
+// WAKE WORD
+// ============================================================
+//
+// While idle the capture task keeps committing frames to captureRing and
+// runs each one through WakeNet; loop() trims the ring to WAKE_PREROLL_MS.
+// When the wake word fires, loop() starts a turn on the ring as it is, so
+// whatever was said right after the wake word is already captured.
+
+#if WAKE_WORD_ENABLED
+const esp_wn_iface_t* wakenet       = nullptr;
+model_iface_data_t*   wakeModel     = nullptr;
+int16_t*              wakeChunk     = nullptr;  // Samples waiting for a full detector chunk
+size_t                wakeChunkSize = 0;
+size_t                wakeChunkFill = 0;
+
+bool setupWakeWord() {
+    srmodel_list_t* models = esp_srmodel_init("model");
+    char* name = models ? esp_srmodel_filter(models, ESP_WN_PREFIX, WAKE_WORD_MODEL) : nullptr;
+    if (!name) {
+        Serial.println("[WAKE] No WakeNet model in the 'model' partition, wake word off");
+        return false;
+    }
+
+    wakenet = (const esp_wn_iface_t*)esp_wn_handle_from_name(name);
+    wakeModel = wakenet->create(name, WAKE_DET_MODE);
+    wakeChunkSize = wakenet->get_samp_chunksize(wakeModel);
+    wakeChunk = (int16_t*)heap_caps_malloc(wakeChunkSize * sizeof(int16_t), MALLOC_CAP_INTERNAL);
+    if (!wakeModel || !wakeChunk) {
+        Serial.println("[WAKE] Could not create WakeNet, wake word off");
+        return false;
+    }
+
+    Serial.printf("[WAKE] Listening for \"%s\" (%s, %u-sample chunks)\n",
+                  wakenet->get_word_name(wakeModel, 1), name, (unsigned)wakeChunkSize);
+    wakeListening = true;
+    return true;
+}
+
+// Capture task: run WakeNet over one frame, true if the wake word fired.
+// Frames are fed directly when they line up with the detector's chunks.
+bool wakeFeed(const int16_t* samples, size_t count) {
+    bool detected = false;
+    while (count > 0) {
+        if (wakeChunkFill == 0 && count >= wakeChunkSize) {
+            detected |= wakenet->detect(wakeModel, (int16_t*)samples) > 0;
+            samples += wakeChunkSize;
+            count -= wakeChunkSize;
+            continue;
+        }
+
+        size_t n = min(count, wakeChunkSize - wakeChunkFill);
+        memcpy(wakeChunk + wakeChunkFill, samples, n * sizeof(int16_t));
+        wakeChunkFill += n;
+        samples += n;
+        count -= n;
+
+        if (wakeChunkFill == wakeChunkSize) {
+            wakeChunkFill = 0;
+            detected |= wakenet->detect(wakeModel, wakeChunk) > 0;
+        }
+    }
+    return detected;
+}
+
+// loop() while idle: keep only the newest WAKE_PREROLL_MS in the ring
+void wakeTrimPreroll() {
+    size_t held = ringAvailable(&captureRing);
+    if (held > WAKE_PREROLL_BYTES) {
+        ringConsume(&captureRing, held - WAKE_PREROLL_BYTES);
+    }
+}
+#endif
+
+// ============================================================
+// ECHO CANCELLATION
+// ============================================================
+//
+// The playback task copies every block it hands the DAC into echoRefRing.
+// The capture task takes one frame of that reference per mic frame and
+// runs ESP-SR's AEC over the pair before the front end, so VAD and WakeNet
+// hear the room with the reply (mostly) removed. The DAC's DMA queue keeps
+// the reference ahead of its echo, and the AEC's adaptive filter absorbs
+// the rest of the delay.
+
+#if ECHO_CANCEL
+aec_handle_t* echoCanceller = nullptr;
+int           echoChunk     = 0;        // Samples per aec_process() call
+alignas(16) static int16_t echoRefBuf[I2S_READ_BUF_SIZE / BYTES_PER_SAMPLE];
+alignas(16) static int16_t echoOutBuf[I2S_READ_BUF_SIZE / BYTES_PER_SAMPLE];
+
+bool setupEchoCancel() {
+    if (!ringInit(&echoRefRing, ECHO_REF_RING_SIZE)) {
+        Serial.println("[AEC] Could not allocate the reference ring, barge-in by button only");
+        return false;
+    }
+
+    echoCanceller = aec_create(AEC_FILTER_LENGTH, CHANNELS, AEC_MODE_SR_LOW_COST);
+    echoChunk = echoCanceller ? aec_get_chunksize(echoCanceller) : 0;
+    if (echoChunk <= 0 || (I2S_READ_BUF_SIZE / BYTES_PER_SAMPLE) % echoChunk != 0) {
+        Serial.println("[AEC] Could not create the echo canceller, barge-in by button only");
+        if (echoCanceller) aec_destroy(echoCanceller);
+        echoCanceller = nullptr;
+        return false;
+    }
+
+    Serial.printf("[AEC] Echo cancellation on (%d-sample chunks)\n", echoChunk);
+    echoCancelActive = true;
+    return true;
+}
+
+// Capture task: remove the speaker's echo from one frame, in place. Frames
+// with nothing playing and no reference left pass through untouched.
+void echoCancel(int16_t* samples, size_t count) {
+    if (!echoCancelActive) return;
+
+    size_t refBytes = ringRead(&echoRefRing, (uint8_t*)echoRefBuf, count * BYTES_PER_SAMPLE);
+    if (refBytes == 0 && !playbackRunning.load()) return;
+    memset((uint8_t*)echoRefBuf + refBytes, 0, count * BYTES_PER_SAMPLE - refBytes);  // DAC underran
+
+    size_t done = 0;
+    for (; done + echoChunk <= count; done += echoChunk) {
+        aec_process(echoCanceller, samples + done, echoRefBuf + done, echoOutBuf + done);
+    }
+    memcpy(samples, echoOutBuf, done * BYTES_PER_SAMPLE);
+}
+#endif
+
+// ============================================================
+// RECORDING
+// ============================================================
+
+// Where frames go when the ring is full (they are dropped, but the DMA
+// still has to be drained)
+static uint8_t captureOverflowBuf[I2S_READ_BUF_SIZE];
+
+// Runs forever on CAPTURE_TASK_CORE. The mic is read continuously so the
+// DMA never overflows; frames are only kept while captureEnabled is set
+// (or, in wake-word mode, all the time as pre-roll).
+// i2s_channel_read() sleeps until the driver's receive interrupt has
+// filled DMA buffers, then copies each frame straight into the ring slot
+// the uplink will send it from, there is no staging buffer.
+void captureTask(void* param) {
+    while (true) {
+        if (micPauseRequested.load()) {
+            i2s_channel_disable(micChannel);    // Releases the driver's PM lock
+            while (micPauseRequested.load()) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);  // Woken by powerWake()
+            }
+            i2s_channel_enable(micChannel);
+        }
+
+        size_t   bytesRead = 0;
+        size_t   span      = 0;
+        uint8_t* slot      = ringWriteSpan(&captureRing, &span);
+        bool     fits      = span >= I2S_READ_BUF_SIZE;
+
+        esp_err_t result = i2s_channel_read(
+            micChannel,
+            fits ? slot : captureOverflowBuf,
+            I2S_READ_BUF_SIZE,
+            &bytesRead,
+            portMAX_DELAY
+        );
+
+        if (result != ESP_OK || bytesRead == 0) continue;
+        captureReads++;
+
+#if BENCHMARK
+        int64_t processStart = esp_timer_get_time();
+#endif
+#if ECHO_CANCEL
+        echoCancel((int16_t*)(fits ? slot : captureOverflowBuf), bytesRead / BYTES_PER_SAMPLE);
+#endif
+#if FRONTEND_ENABLED
+        frontEndProcess((int16_t*)(fits ? slot : captureOverflowBuf), bytesRead / BYTES_PER_SAMPLE);
+#endif
+#if BENCHMARK
+        benchProcessUs += (uint32_t)(esp_timer_get_time() - processStart);
+        benchProcessFrames++;
+#endif
+
+        bool recording = captureEnabled.load();
+        bool listening = wakeListening.load();
+
+        // Frames left uncommitted are simply overwritten by the next read
+        if (!recording && !listening && !captureArmed.load()) continue;
+
+        if (fits) {
+            ringCommit(&captureRing, bytesRead);
+            if (recording) turnMark(STAGE_FIRST_SAMPLE);
+        } else if (recording || captureArmed.load()) {
+            captureRingDrops += bytesRead;
+        }
+
+#if WAKE_WORD_ENABLED
+        // Not during a turn, nor over our own reply unless its echo is cancelled
+        if (listening && !recording && (echoCancelActive || !playbackRunning.load()) && !wakeDetected.load() &&
+            wakeFeed((const int16_t*)(fits ? slot : captureOverflowBuf), bytesRead / BYTES_PER_SAMPLE)) {
+            wakeRingPos = captureRing.head.load();
+            wakeDetected = true;
+        }
+#endif
+    }
+}
+
+void startCaptureTask() {
+    xTaskCreatePinnedToCore(captureTask, "capture", CAPTURE_TASK_STACK, nullptr,
+                            CAPTURE_TASK_PRIORITY, &captureTaskHandle, CAPTURE_TASK_CORE);
+    Serial.printf("[REC] Capture task running on core %d\n", CAPTURE_TASK_CORE);
+}
+
+// `pressPos` is the capture position at the press edge: a button turn
+// keeps what was captured since then
+void startRecording(bool fromWake, size_t pressPos = 0) {
+    recordedBytes = 0;
+    turnState = TURN_RECORDING;
+    turnFromWake = fromWake;
+    recordingStartMs = millis();
+    turnBegin();
+    recordingFull = false;
+    statsCaptureDrops += captureRingDrops.exchange(0);
+    statsMicOverruns  += micDmaOverruns.exchange(0);
+    digitalWrite(LED_PIN, HIGH);       // LED on while recording
+    Serial.println("[REC] Recording started...");
+
+    // Capture first, audio piles up in the ring while the uplink connects.
+    // A wake turn keeps the pre-roll already in the ring.
+    if (fromWake) {
+        vadBegin(WAKE_END_SILENCE_MS, wakeRingPos.load());
+    } else {
+        ringSkipTo(&captureRing, pressPos);
+        vadBegin(VAD_AUTO_END_MS, captureRing.tail.load());
+    }
+    captureEnabled = true;
+    captureArmed = false;
+
+    linkSetActive(true);
+#if TRANSPORT != TRANSPORT_WEBSOCKET
+    hubConnect();   // Usually a no-op: reconnects only if the hub dropped the idle socket
+#endif
+    uplinkBegin();
+}
+
+// Move captured audio from the ring to the uplink (or audioBuffer). While
+// recording only whole blocks are taken; `flush` also takes the remainder.
+void drainCapturedAudio(bool flush) {
+#if VAD_ENABLED
+    vadScan();
+#endif
+
+    while (!recordingFull) {
+        size_t available = 0;
+        const uint8_t* frame = ringReadSpan(&captureRing, &available);
+
+#if VAD_ENABLED
+        // Only audio the VAD cleared goes out, the rest waits in the ring
+        size_t sendable = vadSendableBytes();
+        if (sendable == 0) {
+            vadDropHeld();
+            break;
+        }
+        available = min(available, sendable);
+#endif
+
+        if (available == 0 || (!flush && available < I2S_READ_BUF_SIZE)) break;
+
+        size_t len = min(available, (size_t)I2S_READ_BUF_SIZE);
+
+#if TRANSPORT == TRANSPORT_HTTP_BUFFERED
+        // Check if we have room in the buffer (encoded audio never takes more than PCM)
+        if (recordedBytes + len > MAX_AUDIO_BYTES) {
+            // Buffer full - stop capturing, what we have is sent on release
+            Serial.println("[REC] Buffer full, stopping.");
+            captureEnabled = false;
+            recordingFull = true;
+            ringClear(&captureRing);
+            digitalWrite(LED_PIN, LOW);
+            break;
+        }
+#endif
+
+        uplinkSend(frame, len);
+        ringConsume(&captureRing, len);
+        recordedBytes += len;
+    }
+}
+
+// The release edge's capture position is in the ring once the read in
+// flight at the edge has completed, plus one more in case the task was
+// between reads. Keep draining until then (at most a few reads).
+void captureThrough(uint32_t edgeReads) {
+    uint32_t startMs = millis();
+    while ((int32_t)(captureReads.load() - edgeReads) < 2 && millis() - startMs < 100) {
+        drainCapturedAudio(false);
+        vTaskDelay(1);
+    }
+}
+
+void stopRecording() {
+    captureEnabled = false;
+    captureArmed = false;
+    drainCapturedAudio(true);
+
+    digitalWrite(LED_PIN, LOW);
+
+    float durationSecs = (float)recordedBytes / (SAMPLE_RATE * BYTES_PER_SAMPLE);
+
+    Serial.printf("[REC] Stopped. Recorded %.1f seconds (%d bytes)\n",
+                  durationSecs, recordedBytes);
+
+#if FRONTEND_ENABLED && AGC_ENABLED
+    Serial.printf("[DSP] AGC gain %.1fx\n", frontEnd.gain);
+#endif
+
+    if (captureRingDrops > 0 || micDmaOverruns > 0) {
+        Serial.printf("[REC] Lost audio: %u bytes (ring full), %u DMA overruns\n",
+                      (unsigned)captureRingDrops.load(), (unsigned)micDmaOverruns.load());
+    }
+}
+
+// End of utterance (button released or VAD): send it, or drop it if
+// there's nothing worth sending
+void finishRecording() {
+#if TRANSPORT != TRANSPORT_HTTP_BUFFERED
+    int64_t releaseUs    = esp_timer_get_time();
+    size_t  releaseBytes = uplinkBytes;
+#endif
+    stopRecording();
+
+    // Only send if we captured meaningful audio (> 0.3 seconds)
+    float durationSecs = (float)recordedBytes / (SAMPLE_RATE * BYTES_PER_SAMPLE);
+
+    if (durationSecs > 0.3) {
+        turnState = TURN_UPLOADING; // Until the reply is done, a press or wake word barges in
+        uplinkFinish();
+#if TRANSPORT != TRANSPORT_HTTP_BUFFERED
+        // What was still unsent at release went out at link speed
+        int64_t uploadEndUs = turnStageUs[STAGE_UPLOAD_END].load();
+        if (uploadEndUs > 0) {
+            int64_t tailUs = uploadEndUs - releaseUs;
+            uplinkMeasure(uplinkBytes - releaseBytes, tailUs, tailUs > UPLINK_BACKLOG_MS * 1000, durationSecs);
+        }
+#endif
+        turnReport();
+    } else {
+#if VAD_ENABLED
+        Serial.println(vad.speechSeen ? "[REC] Too short, discarding." : "[VAD] No speech, discarding.");
+#else
+        Serial.println("[REC] Too short, discarding.");
+#endif
+        uplinkCancel();
+    }
+
+    // Back to idle, with the hub socket reopened now rather than on the next press.
+    // A press that barged in is still queued, a wake word still in wakeDetected.
+    turnState = TURN_IDLE;
+    bargeInPending = false;
+#if !BARGE_IN_ENABLED
+    xQueueReset(buttonQueue);   // Without barge-in, presses during the reply don't count
+    captureArmed = false;
+#endif
+    linkSetActive(false);
+#if TRANSPORT != TRANSPORT_WEBSOCKET
+    hubConnect();
+#endif
+}
+
+// The turn state machine's button input
+void buttonHandle(const ButtonEvent& event) {
+    switch (turnState) {
+    case TURN_IDLE:
+        if (event.type == BUTTON_PRESSED) {
+            startRecording(false, event.ringPos);
+        }
+        break;
+    case TURN_RECORDING:
+        // Ends a button turn (a wake turn ends on silence). If the VAD
+        // already ended it, the release arrives in a later state.
+        if (event.type == BUTTON_RELEASED && !turnFromWake) {
+            captureThrough(event.captureReads);
+            finishRecording();
+        }
+        break;
+    case TURN_UPLOADING:
+    case TURN_PLAYING:
+        break;  // Only seen through bargeInPoll(), from inside finishRecording()
+    }
+}
+
+#if BENCHMARK
+// ============================================================
+// BENCHMARK
+// ============================================================
+//
+// Each stage is timed with esp_timer and adds its results to the report.
+// Loads are a share of real time: 100% means the stage alone would use a
+// whole core to keep up. Grab the reports with
+//   pio device monitor -e esp32s3-bench | grep '^\[BENCH\] {'
+
+alignas(16) static uint8_t benchFrame[I2S_READ_BUF_SIZE];   // Internal RAM, for copies and uploads
+static size_t benchEncodedBytes = 0;
+
+static void benchSink(const uint8_t* block, size_t len) {
+    benchEncodedBytes += len;
+}
+
+static float benchLoadPct(int64_t us, uint32_t frames) {
+    if (frames == 0) return 0;
+    return 100.0f * us / frames / (VAD_FRAME_MS * 1000.0f);
+}
+
+// Mic -> ring at full rate, through the capture task as in a turn
+bool benchCapture(JsonDocument& report) {
+    ringClear(&captureRing);
+    captureRingDrops = 0;
+    micDmaOverruns = 0;
+    benchProcessUs = 0;
+    benchProcessFrames = 0;
+
+    size_t   received = 0;
+    int32_t  peak = 0;
+    double   energy = 0;
+    int16_t  first = 0;
+    bool     constant = true;
+
+    captureEnabled = true;
+    int64_t startUs = esp_timer_get_time();
+    while (esp_timer_get_time() - startUs < BENCH_CAPTURE_MS * 1000LL) {
+        size_t available = 0;
+        const int16_t* pcm = (const int16_t*)ringReadSpan(&captureRing, &available);
+        if (available < I2S_READ_BUF_SIZE) {
+            vTaskDelay(1);
+            continue;
+        }
+        for (size_t i = 0; i < I2S_READ_BUF_SIZE / BYTES_PER_SAMPLE; i++) {
+            if (received == 0 && i == 0) first = pcm[0];
+            constant = constant && pcm[i] == first;
+            peak = max(peak, (int32_t)abs(pcm[i]));
+            energy += (double)pcm[i] * pcm[i];
+        }
+        ringConsume(&captureRing, I2S_READ_BUF_SIZE);
+        received += I2S_READ_BUF_SIZE;
+    }
+    captureEnabled = false;
+    int64_t elapsedUs = esp_timer_get_time() - startUs;
+
+    size_t samples = received / BYTES_PER_SAMPLE;
+    JsonObject capture = report["capture"].to<JsonObject>();
+    capture["ms"]            = (uint32_t)(elapsedUs / 1000);
+    capture["bytes"]         = (uint32_t)received;
+    capture["rate_pct"]      = 100.0f * received / (elapsedUs / 1e6f * SAMPLE_RATE * BYTES_PER_SAMPLE);
+    capture["dma_overruns"]  = micDmaOverruns.load();
+    capture["ring_drops"]    = captureRingDrops.load();
+    capture["process_us"]    = benchProcessFrames ? benchProcessUs.load() / benchProcessFrames.load() : 0;
+    capture["process_load_pct"] = benchLoadPct(benchProcessUs.load(), benchProcessFrames.load());
+    capture["peak"]          = peak;
+    capture["rms"]           = samples ? sqrt(energy / samples) : 0;
+
+    // A dead or unwired mic reads all zeros, or one stuck value
+    bool ok = received > 0 && !constant;
+    Serial.printf("[BENCH] Capture: %u bytes in %u ms, %u DMA overruns, front end %.1f%% load, peak %d%s\n",
+                  (unsigned)received, (unsigned)(elapsedUs / 1000), (unsigned)micDmaOverruns.load(),
+                  benchLoadPct(benchProcessUs.load(), benchProcessFrames.load()), (int)peak,
+                  ok ? "" : " - NO SIGNAL");
+    return ok;
+}
+
+// What the uplink pays per frame: the ring's zero-copy span vs copying
+// the frame out of PSRAM first
+void benchCopy(JsonDocument& report) {
+    size_t mask = captureRing.size - 1;
+
+    int64_t startUs = esp_timer_get_time();
+    for (int i = 0; i < BENCH_COPY_FRAMES; i++) {
+        memcpy(benchFrame, captureRing.buf + ((i * I2S_READ_BUF_SIZE) & mask), I2S_READ_BUF_SIZE);
+    }
+    int64_t copyUs = esp_timer_get_time() - startUs;
+
+    volatile size_t sink = 0;
+    startUs = esp_timer_get_time();
+    for (int i = 0; i < BENCH_COPY_FRAMES; i++) {
+        size_t span = 0;
+        sink = sink + (size_t)ringReadSpan(&captureRing, &span) + span;
+    }
+    int64_t spanUs = esp_timer_get_time() - startUs;
+
+    JsonObject copy = report["copy"].to<JsonObject>();
+    copy["memcpy_ns_per_frame"] = (uint32_t)(copyUs * 1000 / BENCH_COPY_FRAMES);
+    copy["span_ns_per_frame"]   = (uint32_t)(spanUs * 1000 / BENCH_COPY_FRAMES);
+    copy["memcpy_mb_s"]         = copyUs ? (float)BENCH_COPY_FRAMES * I2S_READ_BUF_SIZE / copyUs : 0;
+    Serial.printf("[BENCH] Copy: memcpy %u ns/frame, zero-copy span %u ns/frame\n",
+                  (unsigned)(copyUs * 1000 / BENCH_COPY_FRAMES), (unsigned)(spanUs * 1000 / BENCH_COPY_FRAMES));
+}
+
+// IMA-ADPCM over the last captured frames
+void benchEncode(JsonDocument& report) {
+    static AdpcmEncoder encoder;
+    adpcmReset(&encoder);
+    benchEncodedBytes = 0;
+    size_t mask = captureRing.size - 1;
+
+    int64_t startUs = esp_timer_get_time();
+    for (int i = 0; i < BENCH_ENCODE_FRAMES; i++) {
+        adpcmEncode(&encoder, (const int16_t*)(captureRing.buf + ((i * I2S_READ_BUF_SIZE) & mask)),
+                    I2S_READ_BUF_SIZE / BYTES_PER_SAMPLE, benchSink);
+    }
+    int64_t encodeUs = esp_timer_get_time() - startUs;
+
+    JsonObject encode = report["encode"].to<JsonObject>();
+    encode["adpcm_us_per_frame"] = (uint32_t)(encodeUs / BENCH_ENCODE_FRAMES);
+    encode["adpcm_load_pct"]     = benchLoadPct(encodeUs, BENCH_ENCODE_FRAMES);
+    encode["adpcm_ratio"]        = benchEncodedBytes ? (float)BENCH_ENCODE_FRAMES * I2S_READ_BUF_SIZE / benchEncodedBytes : 0;
+    Serial.printf("[BENCH] Encode: ADPCM %u us/frame (%.1f%% load)\n",
+                  (unsigned)(encodeUs / BENCH_ENCODE_FRAMES), benchLoadPct(encodeUs, BENCH_ENCODE_FRAMES));
+}
+
+// BENCH_NET_BYTES up to the hub and back down, over a fresh connection
+// each (the connect time is reported separately)
+bool benchNetwork(JsonDocument& report) {
+    JsonObject network = report["network"].to<JsonObject>();
+    network["rssi"] = WiFi.RSSI();
+    network["hub"]  = serverHost + ":" + serverPort;
+    if (!wifiUp.load()) return false;
+
+    WiFiClient client;
+    int64_t startUs = esp_timer_get_time();
+    if (!client.connect(serverHost.c_str(), serverPort, HUB_CONNECT_TIMEOUT_MS)) {
+        Serial.printf("[BENCH] Network: can't reach %s:%u\n", serverHost.c_str(), serverPort);
+        return false;
+    }
+    network["connect_ms"] = (uint32_t)((esp_timer_get_time() - startUs) / 1000);
+    client.setNoDelay(true);
+
+    memset(benchFrame, 0, sizeof(benchFrame));
+    startUs = esp_timer_get_time();
+    client.printf("POST /api/bench/upload HTTP/1.1\r\nHost: %s\r\nContent-Type: application/octet-stream\r\n"
+                  "Content-Length: %u\r\nConnection: close\r\n\r\n",
+                  serverHost.c_str(), (unsigned)BENCH_NET_BYTES);
+    size_t sent = 0;
+    while (sent < BENCH_NET_BYTES && client.connected()) {
+        size_t written = client.write(benchFrame, min(sizeof(benchFrame), (size_t)BENCH_NET_BYTES - sent));
+        if (written == 0) break;
+        sent += written;
+    }
+    String contentType;
+    int contentLength = 0;
+    bool chunked = false;
+    bool uploaded = readResponseHead(client, contentType, contentLength, chunked) == 200 && sent == BENCH_NET_BYTES;
+    int64_t uploadUs = esp_timer_get_time() - startUs;
+    client.stop();
+
+    bool downloaded = false;
+    size_t received = 0;
+    int64_t downloadUs = 0;
+    if (client.connect(serverHost.c_str(), serverPort, HUB_CONNECT_TIMEOUT_MS)) {
+        startUs = esp_timer_get_time();
+        client.printf("GET /api/bench/download?size=%u HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                      (unsigned)BENCH_NET_BYTES, serverHost.c_str());
+        if (readResponseHead(client, contentType, contentLength, chunked) == 200) {
+            uint32_t lastData = millis();
+            while (received < BENCH_NET_BYTES && millis() - lastData < HTTP_TIMEOUT_MS) {
+                int n = client.read(benchFrame, sizeof(benchFrame));
+                if (n > 0) {
+                    received += n;
+                    lastData = millis();
+                } else if (!client.connected()) {
+                    break;
+                } else {
+                    delay(1);
+                }
+            }
+        }
+        downloadUs = esp_timer_get_time() - startUs;
+        downloaded = received == BENCH_NET_BYTES;
+        client.stop();
+    }
+
+    network["upload_kb_s"]   = uploaded && uploadUs ? BENCH_NET_BYTES * 1000.0f / uploadUs / 1.024f : 0;
+    network["download_kb_s"] = downloaded && downloadUs ? BENCH_NET_BYTES * 1000.0f / downloadUs / 1.024f : 0;
+    Serial.printf("[BENCH] Network: up %.0f KB/s, down %.0f KB/s (RSSI %d dBm)\n",
+                  network["upload_kb_s"].as<float>(), network["download_kb_s"].as<float>(), WiFi.RSSI());
+    return uploaded && downloaded;
+}
+
+// A quiet test tone through the playback task, fed as fast as the ring
+// takes it, as the network side does
+bool benchPlayback(JsonDocument& report) {
+    size_t total = (size_t)SAMPLE_RATE * BENCH_PLAYBACK_MS / 1000 * BYTES_PER_SAMPLE;
+    int16_t block[PLAYBACK_BLOCK_SIZE / BYTES_PER_SAMPLE];
+    size_t phase = 0;
+
+    int64_t startUs = esp_timer_get_time();
+    startPlayback(SAMPLE_RATE);
+    for (size_t written = 0; written < total; ) {
+        size_t len = min(sizeof(block), total - written);
+        if (ringFree(&playbackRing) < len) {
+            vTaskDelay(1);
+            continue;
+        }
+        for (size_t i = 0; i < len / BYTES_PER_SAMPLE; i++, phase++) {
+            block[i] = (int16_t)(3000 * sinf(2 * PI * BENCH_TONE_HZ * phase / SAMPLE_RATE));
+        }
+        ringWrite(&playbackRing, (const uint8_t*)block, len);
+        written += len;
+    }
+    finishPlayback();
+    int64_t elapsedUs = esp_timer_get_time() - startUs;
+
+    JsonObject playback = report["playback"].to<JsonObject>();
+    playback["audio_ms"]       = BENCH_PLAYBACK_MS;
+    playback["elapsed_ms"]     = (uint32_t)(elapsedUs / 1000);
+    playback["underruns"]      = lastPlayUnderruns;
+    playback["dma_underflows"] = lastPlayUnderflows;
+
+    // Prebuffer and DMA drain on top of the audio, anything beyond that is
+    // the DAC not keeping up
+    bool ok = lastPlayUnderruns == 0 && elapsedUs / 1000 < BENCH_PLAYBACK_MS + PLAYBACK_PREBUFFER_MS + 500;
+    Serial.printf("[BENCH] Playback: %u ms of audio in %u ms, %u underruns, %u DMA underflows\n",
+                  (unsigned)BENCH_PLAYBACK_MS, (unsigned)(elapsedUs / 1000),
+                  (unsigned)lastPlayUnderruns, (unsigned)lastPlayUnderflows);
+    return ok;
+}
+
+void benchRun() {
+    Serial.println("\n[BENCH] Running...");
+    bool listening = wakeListening.exchange(false);   // The capture test owns the ring
+
+    JsonDocument report;
+    JsonObject board = report["board"].to<JsonObject>();
+    board["chip"]       = ESP.getChipModel();
+    board["revision"]   = ESP.getChipRevision();
+    board["cpu_mhz"]    = ESP.getCpuFreqMHz();
+    board["psram"]      = ESP.getPsramSize();
+    board["free_heap"]  = ESP.getFreeHeap();
+    board["idf"]        = esp_get_idf_version();
+    board["sketch_md5"] = ESP.getSketchMD5();
+    board["built"]      = __DATE__ " " __TIME__;
+    board["satellite"]  = satelliteId;
+
+    JsonObject config = report["config"].to<JsonObject>();
+    config["transport"] = TRANSPORT;
+    config["codec"]     = UPLINK_CODEC;
+    config["mic_dma"]   = String(MIC_DMA_DESC_NUM) + "x" + MIC_DMA_FRAME_NUM;
+    config["dac_dma"]   = String(DAC_DMA_DESC_NUM) + "x" + DAC_DMA_FRAME_NUM;
+    config["front_end"] = (bool)FRONTEND_ENABLED;
+    config["aec"]       = echoCancelActive;
+
+    JsonObject selftest = report["selftest"].to<JsonObject>();
+    selftest["psram"]    = ESP.getPsramSize() > 0;
+    selftest["mic"]      = benchCapture(report);
+    benchCopy(report);
+    benchEncode(report);
+    selftest["hub"]      = benchNetwork(report);
+    selftest["dac"]      = benchPlayback(report);
+    selftest["wifi"]     = wifiUp.load();
+
+    wakeListening = listening;
+
+    String line;
+    serializeJson(report, line);
+    Serial.print("[BENCH] ");
+    Serial.println(line);
+    Serial.println("[BENCH] Done. Press the button to run again.");
+}
+#endif
+
+// ============================================================
+// SETUP & LOOP
+// ============================================================
+
+void setup() {
+    Serial.begin(115200);
+    delay(1000);
+    Serial.println("\n=============================");
+    Serial.println("  Voice Satellite - ESP32-S3");
+    Serial.println("=============================\n");
+
+    // GPIO setup
+    pinMode(BUTTON_PIN, INPUT_PULLUP);
+    pinMode(LED_PIN, OUTPUT);
+    digitalWrite(LED_PIN, LOW);
+
+#if TRANSPORT == TRANSPORT_HTTP_BUFFERED
+    // Allocate audio buffer (prefer PSRAM for larger buffer). The streaming
+    // transports don't need one, the capture ring is all they hold.
+    audioBuffer = (uint8_t*)ps_malloc(MAX_AUDIO_BYTES + ADPCM_WAV_HEADER_SIZE);
+    if (audioBuffer) {
+        Serial.printf("[MEM] Allocated %d bytes from PSRAM\n", MAX_AUDIO_BYTES + ADPCM_WAV_HEADER_SIZE);
+    } else {
+        // Fallback to regular RAM (smaller buffer)
+        audioBuffer = (uint8_t*)malloc(MAX_AUDIO_BYTES + ADPCM_WAV_HEADER_SIZE);
+        if (audioBuffer) {
+            Serial.printf("[MEM] Allocated %d bytes from heap (no PSRAM)\n", MAX_AUDIO_BYTES + ADPCM_WAV_HEADER_SIZE);
+        } else {
+            Serial.println("[MEM] FATAL: Could not allocate audio buffer!");
+            while (true) { delay(1000); }
+        }
+    }
+#endif
+
+    // Ring buffer between the capture task and the network side
+    if (!ringInit(&captureRing, CAPTURE_RING_SIZE)) {
+        Serial.println("[MEM] FATAL: Could not allocate capture ring!");
+        while (true) { delay(1000); }
+    }
+
+    // Jitter buffer between the network and the playback task
+    if (!ringInit(&playbackRing, PLAYBACK_RING_SIZE)) {
+        Serial.println("[MEM] FATAL: Could not allocate playback ring!");
+        while (true) { delay(1000); }
+    }
+
+    // Initialize I2S
+    setupI2SMic();
+    setupI2SDAC();
+#if FRONTEND_ENABLED
+    frontEndInit();
+#endif
+#if WAKE_WORD_ENABLED
+    setupWakeWord();
+#endif
+#if ECHO_CANCEL
+    setupEchoCancel();
+#endif
+    startCaptureTask();
+    startPlaybackTask();
+    setupButton();
+    setupPowerManagement();
+#if EARCONS_ENABLED
+    setupEarcons();
+#endif
+
+    // Connect to WiFi
+    connectWiFi();
+    initSatelliteId();
+    parseServerUrl();
+    hubSetup();
+    hubSelect();            // Before the first connection, so it goes to the best hub
+    linkSetActive(false);
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    connectWebSocket();     // The hub asks for a sync once connected
+#else
+#if EARCONS_ENABLED
+    earconSync();
+#endif
+    hubConnect();
+#endif
+
+#if BENCHMARK
+    benchRun();
+    return;
+#endif
+
+    Serial.println("\n[READY] Press and hold the button to record.");
+    Serial.println("[READY] Release to send audio to server.");
+    if (wakeListening) {
+        Serial.println("[READY] Or say the wake word and speak.");
+    }
+#if BARGE_IN_ENABLED
+    Serial.printf("[READY] Press the button%s to interrupt a reply.\n",
+                  wakeListening && echoCancelActive ? " or say the wake word" : "");
+#endif
+    Serial.println();
+}
+
+void loop() {
+    connectionService();
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+    webSocket.loop();   // Keeps the session alive and reconnects when needed
+#endif
+
+#if BENCHMARK
+    // Bench build: a press runs the benchmark again, there are no turns
+    ButtonEvent pressed;
+    while (xQueueReceive(buttonQueue, &pressed, 0) == pdTRUE) {
+        if (pressed.type == BUTTON_PRESSED) benchRun();
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+    return;
+#endif
+
+#if WAKE_WORD_ENABLED
+    if (turnState == TURN_IDLE) {
+        if (wakeDetected.exchange(false)) {
+            Serial.println("[WAKE] Wake word detected");
+            // The chime is recorded too: speech only counts after it
+            if (earconPlay(EARCON_LISTENING)) {
+                wakeRingPos = captureRing.head.load();
+            }
+            startRecording(true);
+        } else {
+            wakeTrimPreroll();
+        }
+    }
+#endif
+
+    // Button presses and releases, in order
+    ButtonEvent event;
+    while (xQueueReceive(buttonQueue, &event, 0) == pdTRUE) {
+        buttonHandle(event);
+    }
+
+    // Recording - forward what the capture task has recorded
+    if (turnState == TURN_RECORDING) {
+        drainCapturedAudio(false);
+
+#if VAD_ENABLED
+        if (vadUtteranceEnded()) {
+            Serial.println("[VAD] Silence, ending utterance.");
+            finishRecording();  // For button turns the release is then ignored
+        } else if (turnFromWake && !vad.speechSeen && millis() - recordingStartMs > WAKE_LISTEN_TIMEOUT_MS) {
+            Serial.println("[WAKE] Nothing said after the wake word.");
+            finishRecording();
+        }
+#endif
+    }
+
+    // Between turns: pick a hub (and move to it), then sync its earcons
+    if (turnState == TURN_IDLE && !playbackRunning.load()) {
+        hubService();
+        if (hubChanged) {
+            hubChanged = false;
+#if TRANSPORT == TRANSPORT_WEBSOCKET
+            webSocket.disconnect();
+            connectWebSocket();
+#else
+            hubClient.stop();
+            hubConnect();
+#if EARCONS_ENABLED
+            earconSyncPending = true;
+#endif
+#endif
+        }
+#if EARCONS_ENABLED
+        if (earconSyncPending) {
+            earconSync();
+        }
+#endif
+        statsService();
+    }
 
-    // Small delay to debounce button
-    delay(10);
+    // Idle (light sleep until the button or the next poll), or wait for
+    // the next button event for at most 10 ms
+    bool idle = turnState == TURN_IDLE && !playbackRunning.load() && buttonStable == HIGH
+                && !wakeListening.load();
+    if (powerService(idle)) return;
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
 }
@@ -5,23 +5,33 @@ FastAPI server that receives audio from ESP32 voice satellites,
 processes it through the pipeline, and returns results.
 
 Phase 2: Echo mode (returns same audio)
-Phase 3 (current): Cloud STT via OpenAI Whisper API
-Phase 4+: Will add AI → TTS pipeline
+Phase 3: Cloud STT via OpenAI Whisper API (or Deepgram, streamed during upload)
+Phase 4-6 (current): Claude CLI → Piper TTS, streamed back sentence by sentence
 
 Usage:
     export OPENAI_API_KEY='sk-...'
+    export PIPER_MODEL=/path/to/en_US-lessac-medium.onnx
     python main.py
 """
 
+import asyncio
+import json
 import struct
 import time
 import logging
+from contextlib import asynccontextmanager
 from pathlib import Path
+from typing import Optional
 
-from fastapi import FastAPI, Request
-from fastapi.responses import JSONResponse, Response
+from fastapi import FastAPI, Request, WebSocket, WebSocketDisconnect
+from fastapi.responses import JSONResponse, PlainTextResponse, Response, StreamingResponse
+from starlette.background import BackgroundTask
+from starlette.requests import ClientDisconnect
 
-from services import stt_service
+from services import (
+    ai_service, archive, audio_codec, discovery, earcons, metrics, satellites, scheduler,
+    streaming_stt_service, stt_service, telemetry, tts_cache, tts_service,
+)
 
 # ============================================================
 # CONFIGURATION
@@ -29,7 +39,18 @@ from services import stt_service
 
 HOST = "0.0.0.0"       # Listen on all interfaces
 PORT = 8000
+VERSION = "0.3.0"
 AUDIO_DIR = Path("received_audio")
+TTS_CACHE_DIR = Path("tts_cache")
+EARCON_DIR = Path("earcons")
+
+WAV_HEADER_SIZE = 44
+WAVE_FORMAT_EXTENSIBLE = 0xFFFE  # fmt chunk whose real format is in a sub-format GUID
+WAV_STREAMING_SIZE = 0xFFFFFFFF  # data size sent by satellites that stream while recording
+
+TTS_SAMPLE_RATE = tts_service.OUTPUT_SAMPLE_RATE
+WS_AUDIO_FRAME = 4096  # Reply PCM is sent to WebSocket satellites in frames of this size
+BENCH_MAX_BYTES = 8 * 1024 * 1024  # Largest /api/bench/download
 
 # ============================================================
 # LOGGING
@@ -46,52 +67,462 @@ log = logging.getLogger("voice-hub")
 # APP
 # ============================================================
 
-app = FastAPI(title="Voice Satellite Hub", version="0.3.0")
+@asynccontextmanager
+async def lifespan(app: FastAPI):
+    # Long-lived API clients, shared by all satellites' requests
+    await stt_service.start()
+    await archive.start(AUDIO_DIR)
+    await tts_cache.start(TTS_CACHE_DIR)
+    earcons.load(EARCON_DIR)
+    await discovery.start(PORT, VERSION)
+    yield
+    await discovery.close()
+    await tts_cache.close()
+    await archive.close()
+    await stt_service.close()
+
 
-AUDIO_DIR.mkdir(exist_ok=True)
+app = FastAPI(title="Voice Satellite Hub", version=VERSION, lifespan=lifespan)
+app.add_middleware(metrics.RequestMetrics)
 
 
 @app.get("/api/health")
 async def health():
-    """Health check endpoint."""
+    """
+    Health check endpoint. Satellites probe it to pick a hub: RTT plus
+    `load` (turns in progress and turns queued for a stage).
+    """
+    queues = scheduler.depth()
     return {
         "status": "ok",
-        "version": "0.3.0",
-        "phase": "cloud-stt",
+        "version": VERSION,
+        "phase": "full" if replies_available() else "cloud-stt",
         "services": {
-            "stt": "openai-whisper" if stt_service.is_available() else "no_api_key",
-            "ai": "not_installed",
-            "tts": "not_installed",
-        }
+            "stt": stt_backend(),
+            "ai": "claude-cli" if ai_service.is_available() else "not_installed",
+            "tts": "piper" if tts_service.is_available() else "not_installed",
+        },
+        "satellites": {
+            "known": len(satellites.snapshot()),
+            "active": satellites.active_count(),
+        },
+        "load": {
+            "active_turns": satellites.active_count(),
+            "queued": sum(queue["waiting"] for queue in queues.values()),
+        },
+        "queues": queues,
+        "tts_cache": tts_cache.stats(),
     }
 
 
+@app.get("/api/satellites")
+async def satellite_sessions():
+    """Known satellites by ID: address, transport, connection and turn counts."""
+    return satellites.snapshot()
+
+
+@app.get("/api/earcons")
+async def earcon_list():
+    """Sounds satellites keep in flash: version, and ID, hash and size of each."""
+    return earcons.manifest()
+
+
+@app.get("/api/earcons/{sound_id}")
+async def earcon_audio(sound_id: str, hash: str = None):
+    """
+    One earcon as raw 16 kHz mono 16-bit PCM. With `hash`, answers 409 if
+    the sound has changed since the satellite read the list.
+    """
+    sound = earcons.get(sound_id)
+    if sound is None:
+        return JSONResponse(content={"error": "No such earcon"}, status_code=404)
+    if hash is not None and hash != sound["hash"]:
+        return JSONResponse(content={"error": "Earcon changed, fetch the list again"}, status_code=409)
+    return Response(content=sound["pcm"], media_type="application/octet-stream",
+                    headers={"ETag": f"\"{sound['hash']}\""})
+
+
+@app.get("/api/telemetry")
+async def telemetry_summary():
+    """Per-stage latency (p50/p95, ms) over recent turns, satellite and hub side."""
+    return telemetry.summary()
+
+
+@app.get("/metrics")
+async def prometheus_metrics():
+    """Hub and satellite health in the Prometheus text format."""
+    return PlainTextResponse(metrics.render(VERSION), media_type="text/plain; version=0.0.4")
+
+
+@app.post("/api/stats")
+async def stats_report(request: Request):
+    """Health report from an HTTP satellite (WebSocket ones send a "stats" message)."""
+    try:
+        report = await request.json()
+    except ValueError:
+        return JSONResponse(content={"error": "Expected a JSON object"}, status_code=400)
+    if not isinstance(report, dict):
+        return JSONResponse(content={"error": "Expected a JSON object"}, status_code=400)
+    address = request.client.host if request.client else "unknown"
+    satellite = satellites.identify(request.headers.get("x-satellite-id"), address)
+    satellites.report_stats(satellite, address, "http", metrics.satellite_stats(report))
+    return Response(status_code=204)
+
+
+@app.post("/api/bench/upload")
+async def bench_upload(request: Request):
+    """Network benchmark for satellites' bench firmware: read and discard the body."""
+    started = time.time()
+    received = 0
+    async for chunk in request.stream():
+        received += len(chunk)
+    return {"bytes": received, "ms": round((time.time() - started) * 1000, 1)}
+
+
+@app.get("/api/bench/download")
+async def bench_download(size: int = 256 * 1024):
+    """Network benchmark: `size` bytes of zeros (at most BENCH_MAX_BYTES) to time the download."""
+    return Response(content=bytes(max(0, min(size, BENCH_MAX_BYTES))), media_type="application/octet-stream")
+
+
 @app.post("/api/voice")
 async def process_voice(request: Request):
     """
     Receive audio from ESP32, process through pipeline, return result.
 
+    The body is consumed as it arrives: streaming satellites send it with
+    chunked transfer encoding while the button is still held, so most of
+    the upload is already here by the time the last chunk comes in.
+
     Current mode:
-    - If OPENAI_API_KEY is set: transcribes audio via Whisper API
+    - With Claude CLI and Piper installed: replies with audio/wav, streamed
+      with chunked encoding one sentence at a time as it is synthesized
+    - If only OPENAI_API_KEY is set: returns the transcription as JSON
     - If no API key: falls back to echo mode
 
-    Returns JSON with transcription (for now).
-    Future: will return audio once TTS is added.
+    Satellites send X-Satellite-ID, X-Turn-ID, X-Playback-Rates (reply
+    audio comes at the voice's native rate if listed, else 16 kHz), and
+    X-Prev-Turn-Timing with their own timings of the previous turn; the hub's stage timings go back in a
+    Server-Timing header (STT side only when the reply is streamed, the
+    AI/TTS stages are recorded in telemetry when the stream ends).
     """
     start_time = time.time()
 
-    body = await request.body()
     content_type = request.headers.get("content-type", "unknown")
+    streamed = "chunked" in request.headers.get("transfer-encoding", "").lower()
+    address = request.client.host if request.client else "unknown"
+    satellite = satellites.identify(request.headers.get("x-satellite-id"), address)
+    turn_id = request.headers.get("x-turn-id")
+
+    if "x-prev-turn-timing" in request.headers:
+        prev_turn, stages = telemetry.parse_timing_header(request.headers["x-prev-turn-timing"])
+        telemetry.record_satellite(satellite, prev_turn, stages)
+
+    # With streaming STT, audio after the WAV header is fed to it as it
+    # arrives. The body stays in this one buffer for the rest of the turn.
+    body = bytearray()
+    transcript_stream = None
+    try:
+        async for chunk in request.stream():
+            body.extend(chunk)
+            if transcript_stream is not None:
+                transcript_stream.feed(chunk)
+            elif streaming_stt_service.is_available():
+                transcript_stream, offset = open_transcript_stream(body)
+                if transcript_stream is not None:
+                    transcript_stream.feed(body[offset:])   # Audio that came in with the header
+    except ClientDisconnect:
+        log.warning(f"Satellite aborted upload after {len(body)} bytes")
+        if transcript_stream is not None:
+            transcript_stream.cancel()
+        return Response(status_code=400)
+
+    # With streaming, the request starts at the button press, so this is
+    # mostly recording time. Processing time is measured from here on.
+    upload_elapsed = time.time() - start_time
+    start_time = time.time()
+    log.info(
+        f"Received audio: {len(body)} bytes in {upload_elapsed:.2f}s "
+        f"({'streamed' if streamed else 'buffered'}), content-type: {content_type}"
+    )
 
-    log.info(f"Received audio: {len(body)} bytes, content-type: {content_type}")
-
-    if len(body) < 44:
+    if len(body) < WAV_HEADER_SIZE:
         log.warning("Audio too small (< WAV header size)")
+        if transcript_stream is not None:
+            transcript_stream.cancel()
         return JSONResponse(
             content={"error": "Audio too small"},
             status_code=400
         )
 
+    satellites.turn_started(satellite, address, "http")
+    try:
+        result = await run_pipeline(body, start_time, transcript_stream, satellite)
+    except BaseException:
+        satellites.turn_finished(satellite)
+        raise
+    result["timings"] = {"upload": round(upload_elapsed * 1000, 1), **result["timings"]}
+    headers = {
+        "X-Processing-Time": f"{result['processing_time']:.3f}",
+        "X-Pipeline-Mode": result["pipeline"],
+        "Server-Timing": telemetry.server_timing(result["timings"]),
+    }
+
+    if result["pipeline"] == "full":
+        sample_rate = tts_service.reply_rate(parse_playback_rates(request.headers.get("x-playback-rates")))
+        finished = False
+
+        def finish_turn():
+            # Once, from whichever comes first: the reply ending, or the
+            # response ending without its body ever being iterated (client gone)
+            nonlocal finished
+            if finished:
+                return
+            finished = True
+            satellites.turn_finished(satellite)
+            telemetry.record_hub(satellite, turn_id, result["timings"])
+            metrics.record_turn("http", result["pipeline"], result["timings"])
+
+        async def reply_wav():
+            yield build_wav_header(WAV_STREAMING_SIZE, sample_rate, 16, 1)
+            try:
+                async for pcm in speak_reply(result["transcript"], result["timings"], satellite,
+                                             sample_rate=sample_rate):
+                    yield pcm
+            finally:
+                finish_turn()
+
+        return StreamingResponse(reply_wav(), media_type="audio/wav", headers=headers,
+                                 background=BackgroundTask(finish_turn))
+
+    # No AI/TTS available: return the transcription as JSON
+    satellites.turn_finished(satellite)
+    telemetry.record_hub(satellite, turn_id, result["timings"])
+    metrics.record_turn("http", result["pipeline"], result["timings"])
+    return JSONResponse(content=result, headers=headers)
+
+
+@app.websocket("/ws/voice")
+async def voice_socket(websocket: WebSocket):
+    """
+    Persistent satellite session: one connection carries many turns.
+    The satellite identifies itself with X-Satellite-ID on the handshake,
+    and lists the rates it can play in X-Playback-Rates.
+
+    Binary frames are audio, text frames are JSON control messages:
+    - satellite → hub: {"type": "start", "turn_id", "codec", "sample_rate",
+      "channels", "bits_per_sample" | "block_align"}, audio frames, then
+      {"type": "end"} or {"type": "cancel"}. Codec is "pcm" or "ima_adpcm"
+      (WAV blocks). After the reply has played, {"type": "telemetry",
+      "turn_id", "stages": {name: ms after press}}. {"type": "earcons",
+      "have": {id: hash}} lists the earcons the satellite has stored.
+      {"type": "stats", ...} is its periodic health report (see /metrics).
+    - hub → satellite: optional {"type": "audio_start", "sample_rate"}, PCM frames,
+      {"type": "audio_end"}, then {"type": "result", ...} to end the turn
+      (same fields as the /api/voice JSON reply, including hub "timings",
+      plus the spoken "reply" text). Reply audio is sent per sentence as it
+      is synthesized, while the next sentence is still being generated;
+      sentences the satellite has stored are sent as {"type": "earcon",
+      "id"} instead. {"type": "earcons", "version"} on connect and
+      whenever the set changes asks the satellite to sync its earcons.
+      Messages about a turn carry its "turn_id".
+
+    A turn's reply runs as a task while the socket keeps being read, so a
+    satellite can barge in: "cancel" or the next "start" stops the reply
+    mid-sentence and frees its pipeline slots.
+    """
+    await websocket.accept()
+    address = websocket.client.host if websocket.client else "unknown"
+    satellite = satellites.identify(websocket.headers.get("x-satellite-id"), address)
+    satellites.connected(satellite, address)
+    sample_rate = tts_service.reply_rate(parse_playback_rates(websocket.headers.get("x-playback-rates")))
+    log.info(f"Satellite {satellite} connected over WebSocket from {address} (replies at {sample_rate} Hz)")
+
+    # Ask the satellite to sync its earcons; it answers with what it holds
+    stored_earcons = {}
+    earcons_announced = earcons.version
+    await websocket.send_json({"type": "earcons", "version": earcons_announced})
+
+    audio_format = None
+    pcm = bytearray()
+    transcript_stream = None
+    turn_start = 0.0
+    reply_task = None
+
+    async def reply(pcm: bytearray, audio_format: dict, start_time: float, turn_start: float, stream, turn_id):
+        nonlocal earcons_announced
+        satellites.turn_started(satellite, address, "websocket")
+        try:
+            body = await socket_wav(pcm, audio_format, stream)
+            result = await run_pipeline(body, start_time, stream, satellite)
+            result["timings"] = {"upload": round((start_time - turn_start) * 1000, 1), **result["timings"]}
+
+            if result["pipeline"] == "full":
+                sentences = []
+                await websocket.send_json({"type": "audio_start", "sample_rate": sample_rate, "turn_id": turn_id})
+                async for segment in speak_reply(result["transcript"], result["timings"], satellite,
+                                                 sentences, stored_earcons, sample_rate):
+                    if isinstance(segment, str):
+                        await websocket.send_json({"type": "earcon", "id": segment, "turn_id": turn_id})
+                        continue
+                    for offset in range(0, len(segment), WS_AUDIO_FRAME):
+                        await websocket.send_bytes(segment[offset:offset + WS_AUDIO_FRAME])
+                await websocket.send_json({"type": "audio_end", "turn_id": turn_id})
+                result["reply"] = " ".join(sentences)
+
+            telemetry.record_hub(satellite, turn_id, result["timings"])
+            metrics.record_turn("websocket", result["pipeline"], result["timings"])
+            await websocket.send_json({"type": "result", "turn_id": turn_id, **result})
+
+            # Replies promoted to earcons during the turn
+            if earcons.version != earcons_announced:
+                earcons_announced = earcons.version
+                await websocket.send_json({"type": "earcons", "version": earcons_announced})
+        except asyncio.CancelledError:
+            if stream is not None:
+                stream.cancel()
+            raise
+        except WebSocketDisconnect:
+            pass     # Satellite went away mid-reply
+        except Exception as e:
+            log.error(f"Turn from {satellite} failed: {e}")
+            try:
+                await websocket.send_json({"type": "error", "message": str(e), "turn_id": turn_id})
+            except Exception:
+                pass     # Socket already closed
+        finally:
+            satellites.turn_finished(satellite)
+
+    def interrupt_reply() -> None:
+        if reply_task is not None and not reply_task.done():
+            log.info(f"Satellite {satellite} barged in, stopping its reply")
+            reply_task.cancel()
+
+    try:
+        while True:
+            message = await websocket.receive()
+            if message["type"] == "websocket.disconnect":
+                break
+
+            if message.get("bytes") is not None:
+                if audio_format is not None:
+                    pcm.extend(message["bytes"])
+                    if transcript_stream is not None:
+                        transcript_stream.feed(message["bytes"])
+                continue
+
+            try:
+                control = json.loads(message.get("text") or "")
+            except json.JSONDecodeError:
+                log.warning(f"Ignoring malformed control message from {satellite}")
+                continue
+
+            kind = control.get("type")
+            if kind == "start":
+                interrupt_reply()
+                audio_format = control
+                pcm = bytearray(WAV_HEADER_SIZE)   # Room for the header, written at "end"
+                turn_start = time.time()
+                if transcript_stream is not None:
+                    transcript_stream.cancel()
+                transcript_stream = None
+                if streaming_stt_service.is_available():
+                    adpcm = control.get("codec") == "ima_adpcm"
+                    transcript_stream = TranscriptStream(
+                        control.get("sample_rate", 16000),
+                        control.get("channels", 1),
+                        control.get("block_align", 256) if adpcm else None,
+                    )
+            elif kind == "earcons":
+                stored_earcons = control.get("have") or {}
+                log.info(f"Satellite {satellite} holds {len(stored_earcons)} earcons")
+            elif kind == "telemetry":
+                telemetry.record_satellite(satellite, control.get("turn_id"), control.get("stages") or {})
+            elif kind == "stats":
+                satellites.report_stats(satellite, address, "websocket", metrics.satellite_stats(control))
+            elif kind == "cancel":
+                log.info("Turn cancelled by satellite")
+                interrupt_reply()
+                audio_format = None
+                if transcript_stream is not None:
+                    transcript_stream.cancel()
+                    transcript_stream = None
+            elif kind == "end" and audio_format is not None:
+                start_time = time.time()
+                codec = audio_format.get("codec", "pcm")
+                log.info(
+                    f"Received audio: {len(pcm) - WAV_HEADER_SIZE} bytes in {start_time - turn_start:.2f}s "
+                    f"(websocket, {codec})"
+                )
+                turn_id = audio_format.get("turn_id")
+
+                # The socket is read on while the reply plays, for barge-in
+                reply_task = asyncio.ensure_future(
+                    reply(pcm, audio_format, start_time, turn_start, transcript_stream, turn_id)
+                )
+                audio_format = None
+                transcript_stream = None
+    except WebSocketDisconnect:
+        pass
+    finally:
+        if transcript_stream is not None:
+            transcript_stream.cancel()
+        if reply_task is not None:
+            reply_task.cancel()
+        satellites.disconnected(satellite)
+
+    log.info(f"Satellite disconnected: {satellite}")
+
+
+async def socket_wav(pcm: bytearray, audio_format: dict, stream=None) -> bytearray:
+    """
+    A WebSocket turn's audio as a WAV. PCM gets its header in the room
+    left at the front of `pcm`. IMA-ADPCM is taken from `stream` when
+    streaming STT already decoded it on the way in, else it is decoded in
+    a worker thread, so the event loop keeps serving other satellites.
+    """
+    sample_rate = audio_format.get("sample_rate", 16000)
+    channels = audio_format.get("channels", 1)
+    if audio_format.get("codec", "pcm") != "ima_adpcm":
+        bits_per_sample = audio_format.get("bits_per_sample", 16)
+        pcm[:WAV_HEADER_SIZE] = build_wav_header(len(pcm) - WAV_HEADER_SIZE, sample_rate, bits_per_sample, channels)
+        return pcm
+    if stream is not None:
+        return stream.decoded_wav()
+
+    body = await asyncio.to_thread(
+        audio_codec.decode_ima_adpcm, memoryview(pcm)[WAV_HEADER_SIZE:], audio_format.get("block_align", 256),
+        WAV_HEADER_SIZE,
+    )
+    body[:WAV_HEADER_SIZE] = build_wav_header(len(body) - WAV_HEADER_SIZE, sample_rate, 16, channels)
+    return body
+
+
+async def run_pipeline(body: bytearray, start_time: float, transcript_stream=None,
+                       satellite: str = "unknown") -> dict:
+    """
+    Run one recorded utterance (a complete WAV) through the pipeline.
+
+    `body` is the buffer the upload arrived in. It is fixed up in place
+    and handed to the archive and STT as is, so it mustn't be changed
+    after this is called.
+
+    Shared by the HTTP and WebSocket transports. `start_time` is when the
+    upload finished; processing time is measured from there. With a
+    `transcript_stream` (a TranscriptStream fed during the upload) STT only
+    has to wait for its final result; if it fails, the WAV is sent to
+    Whisper instead. `satellite` keys the archived copy of the recording
+    and its place in the STT queue.
+
+    Covers everything up to the transcript; the spoken reply is produced
+    by speak_reply() when `pipeline` is "full".
+
+    Returns the reply fields: transcript, duration, pipeline, processing_time
+    and timings (ms per hub stage).
+    """
+    timings = {}
+    stage_start = time.time()
+
     # Parse and log WAV info
     wav_info = None
     try:
@@ -105,11 +536,23 @@ async def process_voice(request: Request):
     except Exception as e:
         log.warning(f"Could not parse WAV header: {e}")
 
-    # Save to disk for debugging
-    timestamp = int(time.time())
-    save_path = AUDIO_DIR / f"recording_{timestamp}.wav"
-    save_path.write_bytes(body)
-    log.info(f"Saved to {save_path}")
+    # Compressed uploads are decoded first, everything after works on PCM:
+    # reused from streaming STT if it decoded exactly the data chunk, else
+    # in a worker thread so other satellites aren't held up meanwhile.
+    # Streamed PCM uploads carry a placeholder length, fix it up so the
+    # saved file and the STT upload are a regular WAV.
+    if wav_info and wav_info["audio_format"] == audio_codec.WAVE_FORMAT_IMA_ADPCM:
+        if transcript_stream is not None and wav_info["data_offset"] + wav_info["data_size"] == len(body):
+            body = transcript_stream.decoded_wav()
+        else:
+            body = await asyncio.to_thread(decode_adpcm_wav, body, wav_info)
+        log.info(f"Decoded IMA-ADPCM upload ({wav_info['data_size']} bytes → {len(body)} bytes PCM)")
+    elif wav_info and wav_info["streamed"]:
+        finalize_streamed_wav(body, wav_info)
+    stage_start = _end_stage(timings, "decode", stage_start)
+
+    # Keep the recording for debugging, written in the background
+    archive.submit(satellite, body)
 
     # ──────────────────────────────────────────────
     # PIPELINE
@@ -117,67 +560,342 @@ async def process_voice(request: Request):
 
     transcript = None
     pipeline_mode = "echo"
+    stt_ok = False
 
-    # Phase 3: Cloud STT
-    if stt_service.is_available():
+    # Phase 3: Cloud STT, streamed during the upload if possible
+    if transcript_stream is not None:
+        pipeline_mode = "streaming-stt"
+        try:
+            transcript = await transcript_stream.finish()
+            stt_ok = True
+            log.info(f">>> TRANSCRIPT: \"{transcript}\" (streamed)")
+        except Exception as e:
+            log.error(f"Streaming STT failed: {e}")
+        metrics.record_stt("deepgram-streaming", stt_ok)
+
+    if not stt_ok and stt_service.is_available():
         pipeline_mode = "cloud-stt"
         try:
-            transcript = await stt_service.transcribe(body)
+            # Streamed turns skip the queue: their audio is already transcribed
+            async with scheduler.slot("stt", satellite, timings):
+                transcript = await stt_service.transcribe(body)
+            stt_ok = True
             log.info(f">>> TRANSCRIPT: \"{transcript}\"")
         except Exception as e:
             log.error(f"STT failed: {e}")
             transcript = f"[STT Error: {e}]"
-    else:
-        log.warning("No OPENAI_API_KEY set — running in echo mode")
-
-    # Phase 4 (future): AI response
-    # ai_response = await ai_service.ask(transcript)
+        metrics.record_stt("openai-whisper", stt_ok)
+    elif not stt_ok and transcript_stream is None:
+        log.warning("No OPENAI_API_KEY or DEEPGRAM_API_KEY set — running in echo mode")
 
-    # Phase 5 (future): TTS
-    # response_audio = await tts_service.speak(ai_response)
+    if pipeline_mode != "echo":
+        stage_start = _end_stage(timings, "stt", stage_start)
+    if stt_ok and transcript and replies_available():
+        pipeline_mode = "full"
 
     elapsed = time.time() - start_time
+    timings["processing"] = round(elapsed * 1000, 1)
     log.info(f"Processing complete in {elapsed:.2f}s")
 
-    # Return transcription as JSON
-    # (Once TTS is added, this will return audio/wav instead)
-    return JSONResponse(
-        content={
-            "transcript": transcript,
-            "duration": wav_info["duration"] if wav_info else None,
-            "pipeline": pipeline_mode,
-            "processing_time": round(elapsed, 3),
-        },
-        headers={
-            "X-Processing-Time": f"{elapsed:.3f}",
-            "X-Pipeline-Mode": pipeline_mode,
-        }
-    )
+    return {
+        "transcript": transcript,
+        "duration": wav_info["duration"] if wav_info else None,
+        "pipeline": pipeline_mode,
+        "processing_time": round(elapsed, 3),
+        "timings": timings,
+    }
 
 
-def parse_wav_header(data: bytes) -> dict:
-    """Parse a WAV file header and return audio properties."""
-    if data[:4] != b'RIFF' or data[8:12] != b'WAVE':
-        raise ValueError("Not a valid WAV file")
+def stt_backend() -> str:
+    """Name of the STT backend turns will use."""
+    if streaming_stt_service.is_available():
+        return "deepgram-streaming"
+    return "openai-whisper" if stt_service.is_available() else "no_api_key"
+
 
-    audio_format = struct.unpack_from('<H', data, 20)[0]
-    channels = struct.unpack_from('<H', data, 22)[0]
-    sample_rate = struct.unpack_from('<I', data, 24)[0]
-    bits_per_sample = struct.unpack_from('<H', data, 34)[0]
-    data_size = struct.unpack_from('<I', data, 40)[0]
+class TranscriptStream:
+    """
+    A turn's audio on its way to streaming STT, fed as it arrives.
+
+    IMA-ADPCM uploads are decoded a whole block at a time (a frame's
+    worth, well under a millisecond) and the PCM is kept, so the turn
+    doesn't decode the upload a second time; PCM is passed on in whole
+    samples.
+    """
 
-    duration = data_size / (sample_rate * channels * (bits_per_sample // 8))
+    def __init__(self, sample_rate: int, channels: int, block_align: int = None):
+        self.session = streaming_stt_service.StreamingSession(sample_rate, channels)
+        self.sample_rate = sample_rate
+        self.channels = channels
+        self.block_align = block_align
+        self.unit = block_align or 2 * channels
+        self.pending = bytearray()
+        self.pcm = bytearray(WAV_HEADER_SIZE) if block_align else None   # Decoded so far, after header room
+        self.ended = False
+
+    def feed(self, data: bytes) -> None:
+        # Whole units go out as a view of `data`; only a split unit is copied
+        if self.pending:
+            self.pending.extend(data)
+            data, self.pending = self.pending, bytearray()
+        whole = len(data) - len(data) % self.unit
+        if whole:
+            self._send(memoryview(data)[:whole])
+        if whole < len(data):
+            self.pending = bytearray(data[whole:])
+
+    def end(self) -> None:
+        """The upload is complete: send the final partial block."""
+        if not self.ended and self.block_align and len(self.pending) >= 4:
+            self._send(self.pending)
+        self.pending = bytearray()
+        self.ended = True
+
+    def decoded_wav(self) -> bytearray:
+        """An IMA-ADPCM upload as the 16-bit PCM WAV decoded while streaming."""
+        self.end()
+        self.pcm[:WAV_HEADER_SIZE] = build_wav_header(len(self.pcm) - WAV_HEADER_SIZE, self.sample_rate, 16,
+                                                      self.channels)
+        return self.pcm
+
+    async def finish(self) -> str:
+        self.end()
+        return await self.session.finish()
+
+    def cancel(self) -> None:
+        self.session.cancel()
+
+    def _send(self, data: bytes) -> None:
+        if self.block_align:
+            data = audio_codec.decode_ima_adpcm(data, self.block_align)
+            self.pcm += data
+        self.session.feed(data)
+
+
+def open_transcript_stream(body: bytearray):
+    """
+    Start streaming STT for an HTTP upload once its WAV header is in.
+
+    Returns (TranscriptStream, offset of the first audio byte), or
+    (None, 0) while the header is still incomplete or isn't usable.
+    """
+    try:
+        info = parse_wav_header(body)
+    except ValueError:
+        return None, 0
+
+    adpcm = info["audio_format"] == audio_codec.WAVE_FORMAT_IMA_ADPCM
+    stream = TranscriptStream(info["sample_rate"], info["channels"], info["block_align"] if adpcm else None)
+    return stream, info["data_offset"]
+
+
+def replies_available() -> bool:
+    """AI and TTS are both installed, so turns get a spoken reply."""
+    return ai_service.is_available() and tts_service.is_available()
+
+
+async def speak_reply(transcript: str, timings: dict, satellite: str = "unknown", sentences: list = None,
+                      stored_earcons: dict = None, sample_rate: int = TTS_SAMPLE_RATE):
+    """
+    Generate and speak the reply to `transcript`, yielding PCM at
+    `sample_rate` one sentence at a time.
+
+    Three stages overlap: Claude streams its reply, each finished sentence
+    is queued for Piper right away, and audio is yielded in order as each
+    sentence is synthesized, so the first sentence plays while the rest is
+    still being written and spoken. Claude and Piper are shared by all
+    satellites, so each call waits for a scheduler slot, queued fairly by
+    `satellite`; phrases already in the TTS cache skip Piper and its queue.
+    Sentences stored on the satellite as earcons (`stored_earcons`, id ->
+    hash) are yielded as their earcon ID (a str) instead of PCM.
+    Adds ai / tts (busy time), ai_first_sentence / tts_first_audio (from
+    reply start), tts_cached (sentences served from the cache) and the
+    time spent queued to `timings`, and appends the spoken sentences to
+    `sentences` if given.
+    """
+    reply_start = time.time()
+    segments: asyncio.Queue = asyncio.Queue()
+    tts_busy = 0.0
+
+    async def synthesize(sentence: str):
+        nonlocal tts_busy
+        if stored_earcons:
+            sound_id = earcons.reply_id(sentence)
+            sound = earcons.get(sound_id)
+            if sound is not None and stored_earcons.get(sound_id) == sound["hash"]:
+                timings["earcons"] = timings.get("earcons", 0) + 1
+                return sound_id
+
+        pcm = await tts_service.cached(sentence, sample_rate)
+        if pcm is not None:
+            timings["tts_cached"] = timings.get("tts_cached", 0) + 1
+        else:
+            async with scheduler.slot("tts", satellite, timings):
+                started = time.time()
+                pcm = await tts_service.synthesize(sentence, sample_rate)
+                tts_busy += time.time() - started
+        earcons.note_reply(sentence, pcm, sample_rate)
+        return pcm
+
+    async def generate():
+        try:
+            async with scheduler.slot("ai", satellite, timings):
+                async for sentence in ai_service.stream_sentences(transcript):
+                    if "ai_first_sentence" not in timings:
+                        timings["ai_first_sentence"] = round((time.time() - reply_start) * 1000, 1)
+                    log.info(f"<<< REPLY: \"{sentence}\"")
+                    if sentences is not None:
+                        sentences.append(sentence)
+                    await segments.put(asyncio.ensure_future(synthesize(sentence)))
+        except Exception as e:
+            log.error(f"AI failed: {e}")
+        finally:
+            timings["ai"] = round((time.time() - reply_start) * 1000, 1)
+            await segments.put(None)
+
+    generator = asyncio.ensure_future(generate())
+    try:
+        while (segment := await segments.get()) is not None:
+            try:
+                pcm = await segment
+            except Exception as e:
+                log.error(f"TTS failed: {e}")
+                continue
+            if "tts_first_audio" not in timings:
+                timings["tts_first_audio"] = round((time.time() - reply_start) * 1000, 1)
+            yield pcm
+    finally:
+        generator.cancel()
+        while not segments.empty():
+            segment = segments.get_nowait()
+            if segment is not None:
+                segment.cancel()
+        timings["tts"] = round(tts_busy * 1000, 1)
+        log.info(f"Reply spoken in {time.time() - reply_start:.2f}s")
+
+
+def _end_stage(timings: dict, name: str, stage_start: float) -> float:
+    """Record how long a pipeline stage took (ms) and return the next stage's start."""
+    now = time.time()
+    timings[name] = round((now - stage_start) * 1000, 1)
+    return now
+
+
+def parse_wav_header(data) -> dict:
+    """
+    Parse a WAV file's chunks and return audio properties.
+
+    `data` is any bytes-like object (the upload's buffer, possibly still
+    arriving) and is read in place. The RIFF chunks are walked in order:
+    fmt (PCM, IMA-ADPCM or WAVE_FORMAT_EXTENSIBLE), then fact, LIST or any
+    other chunk is skipped up to data, honouring the pad byte after
+    odd-sized chunks. A data chunk sized WAV_STREAMING_SIZE, or one that
+    runs past the end of `data`, holds everything up to the end.
+
+    Raises:
+        ValueError: If it isn't a WAV, or the header hasn't all arrived yet
+    """
+    if len(data) < 12:
+        raise ValueError("Truncated WAV header")
+    riff, _, wave = struct.unpack_from('<4sI4s', data, 0)
+    if riff != b'RIFF' or wave != b'WAVE':
+        raise ValueError("Not a valid WAV file")
+
+    fmt = None
+    offset = 12
+    while True:
+        if offset + 8 > len(data):
+            raise ValueError("No data chunk" if fmt else "No fmt chunk")
+        chunk_id, chunk_size = struct.unpack_from('<4sI', data, offset)
+        if chunk_id == b'data':
+            break
+        if chunk_id == b'fmt ':
+            if chunk_size < 16 or offset + 8 + chunk_size > len(data):
+                raise ValueError("Truncated fmt chunk")
+            fmt = struct.unpack_from('<HHIIHH', data, offset + 8)
+            if fmt[0] == WAVE_FORMAT_EXTENSIBLE and chunk_size >= 40:
+                # The real format is the first two bytes of the sub-format GUID
+                fmt = struct.unpack_from('<H', data, offset + 32) + fmt[1:]
+            elif fmt[0] == audio_codec.WAVE_FORMAT_IMA_ADPCM and chunk_size >= 20:
+                fmt += struct.unpack_from('<H', data, offset + 26)   # Samples per block
+        offset += 8 + chunk_size + (chunk_size & 1)
+
+    if fmt is None:
+        raise ValueError("No fmt chunk before data")
+    audio_format, channels, sample_rate, _, block_align, bits_per_sample = fmt[:6]
+    samples_per_block = fmt[6] if len(fmt) > 6 else None
+    if not (channels and sample_rate and block_align):
+        raise ValueError("Invalid fmt chunk")
+
+    # Streaming satellites don't know the length up front
+    data_offset = offset + 8
+    available = len(data) - data_offset
+    streamed = chunk_size == WAV_STREAMING_SIZE or chunk_size > available
+    data_size = available if streamed else chunk_size
+
+    if samples_per_block:
+        duration = data_size / block_align * samples_per_block / sample_rate
+    else:
+        duration = data_size / (sample_rate * block_align)
 
     return {
         "audio_format": audio_format,
         "channels": channels,
         "sample_rate": sample_rate,
         "bits_per_sample": bits_per_sample,
+        "block_align": block_align,
+        "samples_per_block": samples_per_block,
+        "data_offset": data_offset,
         "data_size": data_size,
         "duration": duration,
+        "streamed": streamed,
     }
 
 
+def wav_audio(data, wav_info: dict) -> memoryview:
+    """The data chunk payload of a parsed WAV, as a view into `data`."""
+    start = wav_info["data_offset"]
+    return memoryview(data)[start:start + wav_info["data_size"]]
+
+
+def decode_adpcm_wav(data, wav_info: dict) -> bytearray:
+    """Turn an IMA-ADPCM upload into a regular 16-bit PCM WAV."""
+    pcm = audio_codec.decode_ima_adpcm(wav_audio(data, wav_info), wav_info["block_align"], WAV_HEADER_SIZE)
+    pcm[:WAV_HEADER_SIZE] = build_wav_header(len(pcm) - WAV_HEADER_SIZE, wav_info["sample_rate"], 16,
+                                             wav_info["channels"])
+    return pcm
+
+
+def parse_playback_rates(header: Optional[str]) -> set:
+    """Sample rates from an X-Playback-Rates header ("16000,22050"); 16 kHz without one."""
+    rates = {TTS_SAMPLE_RATE}
+    for rate in (header or "").split(","):
+        if rate.strip().isdigit():
+            rates.add(int(rate))
+    return rates
+
+
+def build_wav_header(data_size: int, sample_rate: int, bits_per_sample: int, channels: int) -> bytes:
+    """
+    Build a 44-byte PCM WAV header (same layout the ESP32 writes).
+    A data_size of WAV_STREAMING_SIZE marks both sizes as unknown.
+    """
+    block_align = channels * (bits_per_sample // 8)
+    riff_size = WAV_STREAMING_SIZE if data_size == WAV_STREAMING_SIZE else data_size + WAV_HEADER_SIZE - 8
+    return struct.pack(
+        '<4sI4s4sIHHIIHH4sI',
+        b'RIFF', riff_size, b'WAVE',
+        b'fmt ', 16, 1, channels, sample_rate, sample_rate * block_align, block_align, bits_per_sample,
+        b'data', data_size,
+    )
+
+
+def finalize_streamed_wav(data: bytearray, wav_info: dict) -> None:
+    """Write the real RIFF and data sizes into a streamed WAV, in place."""
+    struct.pack_into('<I', data, 4, wav_info["data_offset"] + wav_info["data_size"] - 8)
+    struct.pack_into('<I', data, wav_info["data_offset"] - 4, wav_info["data_size"])
+
+
 # ============================================================
 # ENTRY POINT
 # ============================================================
@@ -185,11 +903,18 @@ def parse_wav_header(data: bytes) -> dict:
 if __name__ == "__main__":
     import uvicorn
 
-    stt_status = "READY" if stt_service.is_available() else "NO API KEY (echo mode)"
+    stt_status = {
+        "deepgram-streaming": "READY (Deepgram, streaming)",
+        "openai-whisper": "READY (Whisper)",
+    }.get(stt_backend(), "NO API KEY (echo mode)")
+    ai_status = "READY" if ai_service.is_available() else "claude CLI not found"
+    tts_status = "READY" if tts_service.is_available() else "PIPER_MODEL not set (no spoken replies)"
 
     log.info("=" * 50)
     log.info("  Voice Satellite Hub")
     log.info(f"  STT: {stt_status}")
+    log.info(f"  AI:  {ai_status}")
+    log.info(f"  TTS: {tts_status}")
     log.info(f"  Listening on http://{HOST}:{PORT}")
     log.info("=" * 50)
 
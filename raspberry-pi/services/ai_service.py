@@ -0,0 +1,121 @@
+"""
+AI Service - Claude Code CLI
+
+Runs `claude -p` as a subprocess to answer the transcribed request.
+The reply is streamed (stream-json output with partial messages) and cut
+into sentences as it arrives, so TTS can start on the first sentence
+while the rest is still being generated.
+
+Requires the `claude` CLI on PATH (or CLAUDE_CLI pointing at it).
+"""
+
+import asyncio
+import json
+import logging
+import os
+import re
+import shutil
+from typing import AsyncIterator
+
+log = logging.getLogger("voice-hub.ai")
+
+CLAUDE_CLI = os.environ.get("CLAUDE_CLI", "claude")
+AI_TIMEOUT = float(os.environ.get("AI_TIMEOUT", "60"))
+
+PROMPT = (
+    "You are a voice assistant; your reply will be spoken aloud. "
+    "Answer briefly in plain sentences, without markdown, lists or code. "
+    "User said: {transcript}"
+)
+
+# Sentence end: . ! ? (optionally followed by quotes/brackets), then whitespace
+_SENTENCE_END = re.compile(r'[.!?]+["\')\]]*\s+')
+
+# Shorter pieces are held back and spoken with the next sentence,
+# so "Yes." or "Dr." don't become separate TTS calls
+MIN_SENTENCE_CHARS = 20
+
+
+def is_available() -> bool:
+    """Check if the Claude CLI is installed."""
+    return shutil.which(CLAUDE_CLI) is not None
+
+
+def _split_sentences(buffer: str) -> tuple[list, str]:
+    """Split complete sentences off the front of `buffer`, return (sentences, rest)."""
+    sentences = []
+    start = 0
+    for match in _SENTENCE_END.finditer(buffer):
+        if match.end() - start >= MIN_SENTENCE_CHARS:
+            sentences.append(buffer[start:match.end()].strip())
+            start = match.end()
+    return sentences, buffer[start:]
+
+
+async def _stream_text(prompt: str) -> AsyncIterator[str]:
+    """Yield reply text from the CLI as it is generated."""
+    process = await asyncio.create_subprocess_exec(
+        CLAUDE_CLI, "-p", prompt,
+        "--output-format", "stream-json", "--verbose", "--include-partial-messages",
+        stdout=asyncio.subprocess.PIPE,
+        stderr=asyncio.subprocess.PIPE,
+    )
+    # Drained alongside stdout: a full stderr pipe would stall the CLI
+    stderr_read = asyncio.ensure_future(process.stderr.read())
+
+    streamed = False
+    try:
+        while True:
+            line = await asyncio.wait_for(process.stdout.readline(), timeout=AI_TIMEOUT)
+            if not line:
+                break
+            try:
+                message = json.loads(line)
+            except json.JSONDecodeError:
+                continue
+
+            # Text deltas as they are generated, or the whole reply at the end
+            # if this CLI version doesn't send partial messages
+            if message.get("type") == "stream_event":
+                delta = message.get("event", {}).get("delta", {})
+                if delta.get("type") == "text_delta":
+                    streamed = True
+                    yield delta.get("text", "")
+            elif message.get("type") == "result":
+                if message.get("is_error"):
+                    raise RuntimeError(f"Claude CLI error: {message.get('result', '')[:500]}")
+                if not streamed:
+                    yield message.get("result", "")
+    finally:
+        if process.returncode is None:
+            process.kill()
+        await process.wait()
+        stderr = await stderr_read   # The pipe closes with the process
+
+    if process.returncode not in (0, -9):
+        stderr = stderr.decode(errors="replace")
+        raise RuntimeError(f"Claude CLI exited with {process.returncode}: {stderr[:500]}")
+
+
+async def stream_sentences(transcript: str) -> AsyncIterator[str]:
+    """
+    Ask Claude and yield the reply one sentence at a time, as soon as
+    each sentence is complete.
+
+    Raises:
+        RuntimeError: If the CLI fails or times out
+    """
+    log.info(f"Asking Claude: \"{transcript}\"")
+
+    buffer = ""
+    try:
+        async for text in _stream_text(PROMPT.format(transcript=transcript)):
+            buffer += text
+            sentences, buffer = _split_sentences(buffer)
+            for sentence in sentences:
+                yield sentence
+    except asyncio.TimeoutError:
+        raise RuntimeError(f"Claude CLI gave no output for {AI_TIMEOUT:.0f}s")
+
+    if buffer.strip():
+        yield buffer.strip()
@@ -0,0 +1,133 @@
+"""
+Recording Archive - background writer for received utterances
+
+Every turn's WAV is kept for debugging, but writing it must never hold
+up the turn. submit() only queues the recording; a worker task writes it
+from a thread, optionally gzipped, and enforces the retention limits.
+If the disk falls behind and the queue fills up, recordings are dropped
+rather than making requests wait.
+
+Files are laid out per satellite and named by time and a hub-wide
+sequence number, so concurrent satellites never collide:
+    received_audio/<satellite>/<YYYYmmdd-HHMMSS>-<seq>.wav[.gz]
+
+Configured with ARCHIVE_ENABLED, ARCHIVE_COMPRESS, ARCHIVE_MAX_FILES,
+ARCHIVE_MAX_MB and ARCHIVE_QUEUE_SIZE.
+"""
+
+import asyncio
+import gzip
+import itertools
+import logging
+import os
+import re
+import time
+from collections import deque
+from pathlib import Path
+from typing import Optional
+
+log = logging.getLogger("voice-hub.archive")
+
+ENABLED = os.environ.get("ARCHIVE_ENABLED", "1") != "0"
+COMPRESS = os.environ.get("ARCHIVE_COMPRESS", "0") != "0"
+MAX_FILES = int(os.environ.get("ARCHIVE_MAX_FILES", "1000"))
+MAX_BYTES = int(float(os.environ.get("ARCHIVE_MAX_MB", "500")) * 1024 * 1024)
+QUEUE_SIZE = int(os.environ.get("ARCHIVE_QUEUE_SIZE", "32"))
+
+_directory: Optional[Path] = None
+_queue: Optional[asyncio.Queue] = None
+_worker: Optional[asyncio.Task] = None
+_sequence = itertools.count(1)
+_files: deque = deque()   # (path, size) oldest first, for retention
+_total_bytes = 0
+
+
+def _safe_name(value: str) -> str:
+    return re.sub(r"[^A-Za-z0-9._-]", "_", value)[:64] or "unknown"
+
+
+def _scan(directory: Path) -> None:
+    """Pick up recordings from earlier runs so retention covers them too."""
+    global _total_bytes
+    found = []
+    for path in directory.rglob("*.wav*"):
+        stat = path.stat()
+        found.append((stat.st_mtime, path, stat.st_size))
+    for _, path, size in sorted(found):
+        _files.append((path, size))
+        _total_bytes += size
+
+
+def _write(path: Path, data: bytes) -> None:
+    """Runs in a worker thread: write one recording and apply retention."""
+    global _total_bytes
+    path.parent.mkdir(parents=True, exist_ok=True)
+    if COMPRESS:
+        data = gzip.compress(data, compresslevel=6)
+    path.write_bytes(data)
+
+    _files.append((path, len(data)))
+    _total_bytes += len(data)
+    while _files and (len(_files) > MAX_FILES or _total_bytes > MAX_BYTES):
+        old_path, old_size = _files.popleft()
+        old_path.unlink(missing_ok=True)
+        _total_bytes -= old_size
+
+
+async def _run() -> None:
+    while True:
+        path, data = await _queue.get()
+        try:
+            await asyncio.to_thread(_write, path, data)
+            log.info(f"Saved to {path}")
+        except OSError as e:
+            log.error(f"Could not archive {path}: {e}")
+        finally:
+            _queue.task_done()
+
+
+async def start(directory: Path) -> None:
+    """Start the writer (app startup)."""
+    global _directory, _queue, _worker
+    if not ENABLED:
+        log.info("Recording archive disabled")
+        return
+
+    _directory = directory
+    _directory.mkdir(exist_ok=True)
+    await asyncio.to_thread(_scan, _directory)
+    _queue = asyncio.Queue(maxsize=QUEUE_SIZE)
+    _worker = asyncio.create_task(_run())
+
+
+async def close() -> None:
+    """Write out what's still queued and stop the writer (app shutdown)."""
+    global _worker
+    if _worker is None:
+        return
+    await _queue.join()
+    _worker.cancel()
+    _worker = None
+
+
+def submit(satellite: str, wav: bytes) -> Optional[Path]:
+    """
+    Queue a recording for archival without waiting for the disk.
+
+    Returns the path it will be written to, or None if the archive is off
+    or its queue is full (the recording is then not kept).
+    """
+    if _queue is None:
+        return None
+
+    name = f"{time.strftime('%Y%m%d-%H%M%S')}-{next(_sequence):06d}.wav"
+    if COMPRESS:
+        name += ".gz"
+    path = _directory / _safe_name(satellite) / name
+
+    try:
+        _queue.put_nowait((path, wav))
+    except asyncio.QueueFull:
+        log.warning(f"Archive queue full, not keeping {path.name}")
+        return None
+    return path
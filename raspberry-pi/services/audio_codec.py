@@ -0,0 +1,97 @@
+"""
+Audio Codecs - decoding of compressed satellite uploads, rate conversion
+
+Satellites can send IMA-ADPCM (WAV format 0x11) instead of raw PCM to cut
+uplink bandwidth by 4x. Everything downstream (STT, saved recordings)
+works on 16-bit PCM, so uploads are decoded here first.
+
+Reply audio is only resampled when a satellite can't play the TTS voice's
+native rate (see tts_service.reply_rate()).
+"""
+
+import struct
+
+import numpy as np
+
+WAVE_FORMAT_PCM = 0x0001
+WAVE_FORMAT_IMA_ADPCM = 0x0011
+
+_STEP_TABLE = (
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+)
+
+_INDEX_TABLE = (-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8)
+
+# Per (step index, nibble): signed predictor change and next step index.
+# Precomputed so the per-sample loop is two table lookups and a clamp.
+_DELTA = []
+_NEXT_INDEX = []
+for _index, _step in enumerate(_STEP_TABLE):
+    for _nibble in range(16):
+        _diff = _step >> 3
+        if _nibble & 4:
+            _diff += _step
+        if _nibble & 2:
+            _diff += _step >> 1
+        if _nibble & 1:
+            _diff += _step >> 2
+        _DELTA.append(-_diff if _nibble & 8 else _diff)
+        _NEXT_INDEX.append(min(max(_index + _INDEX_TABLE[_nibble], 0), 88))
+
+
+def decode_ima_adpcm(data, block_align: int, header_room: int = 0) -> bytearray:
+    """
+    Decode mono WAV IMA-ADPCM data (the data chunk payload, any bytes-like
+    object) to 16-bit PCM.
+
+    Each block starts with a 4-byte header (first sample, step index),
+    followed by 4-bit samples, low nibble first. A trailing partial
+    block is decoded as far as it goes.
+
+    Returns little-endian 16-bit PCM, after `header_room` zero bytes the
+    caller can write a WAV header into without copying the audio.
+    """
+    samples = []
+    append = samples.append
+    delta_table = _DELTA
+    index_table = _NEXT_INDEX
+
+    for offset in range(0, len(data) - 3, block_align):
+        block = data[offset:offset + block_align]
+        predictor, index = struct.unpack_from('<hB', block, 0)
+        index = min(index, 88)
+        append(predictor)
+
+        for byte in block[4:]:
+            for nibble in (byte & 0x0F, byte >> 4):
+                key = (index << 4) | nibble
+                predictor += delta_table[key]
+                if predictor > 32767:
+                    predictor = 32767
+                elif predictor < -32768:
+                    predictor = -32768
+                index = index_table[key]
+                append(predictor)
+
+    pcm = bytearray(header_room + 2 * len(samples))
+    struct.pack_into(f'<{len(samples)}h', pcm, header_room, *samples)
+    return pcm
+
+
+def resample(pcm: bytes, rate_from: int, rate_to: int) -> bytes:
+    """Convert 16-bit mono PCM between sample rates."""
+    samples = np.frombuffer(pcm, dtype=np.int16)
+    if rate_from == rate_to or len(samples) == 0:
+        return pcm
+
+    # Linear interpolation is plenty for speech going to a small speaker
+    count = int(len(samples) * rate_to / rate_from)
+    positions = np.arange(count) * (rate_from / rate_to)
+    resampled = np.interp(positions, np.arange(len(samples)), samples.astype(np.float32))
+    return resampled.astype(np.int16).tobytes()
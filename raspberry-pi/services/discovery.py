@@ -0,0 +1,83 @@
+"""
+Hub Discovery - mDNS advertisement for satellites
+
+The hub announces itself as a _voicehub._tcp service, so satellites find
+every hub on the LAN without a hardcoded address and pick between them
+by /api/health latency and load.
+
+Needs the `zeroconf` package; without it (or with MDNS_ENABLED=0) the hub
+isn't advertised and satellites use their SERVER_URL. HUB_NAME sets the
+instance name (default: the host name).
+"""
+
+import logging
+import os
+import socket
+from typing import Optional
+
+try:
+    from zeroconf.asyncio import AsyncServiceInfo, AsyncZeroconf
+except ImportError:
+    AsyncZeroconf = None
+
+log = logging.getLogger("voice-hub.discovery")
+
+ENABLED = os.environ.get("MDNS_ENABLED", "1") != "0"
+HUB_NAME = os.environ.get("HUB_NAME", socket.gethostname())
+SERVICE_TYPE = "_voicehub._tcp.local."
+
+_zeroconf = None
+_info = None
+
+
+def _lan_address() -> Optional[str]:
+    """The address other LAN hosts reach us at (no packet is sent)."""
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as probe:
+        try:
+            probe.connect(("10.255.255.255", 1))
+            return probe.getsockname()[0]
+        except OSError:
+            return None
+
+
+async def start(port: int, version: str) -> None:
+    """Advertise the hub on `port` (app startup)."""
+    global _zeroconf, _info
+    if not ENABLED:
+        return
+    if AsyncZeroconf is None:
+        log.info("zeroconf not installed, hub not advertised over mDNS")
+        return
+
+    address = _lan_address()
+    if address is None:
+        log.warning("No LAN address, hub not advertised over mDNS")
+        return
+
+    _info = AsyncServiceInfo(
+        SERVICE_TYPE,
+        f"{HUB_NAME}.{SERVICE_TYPE}",
+        addresses=[socket.inet_aton(address)],
+        port=port,
+        properties={"path": "/api/voice", "ws": "/ws/voice", "version": version},
+        server=f"{socket.gethostname()}.local.",
+    )
+    _zeroconf = AsyncZeroconf()
+    try:
+        await _zeroconf.async_register_service(_info)
+    except Exception as e:
+        log.error(f"mDNS registration failed: {e}")
+        await _zeroconf.async_close()
+        _zeroconf = None
+        return
+    log.info(f"Advertising {HUB_NAME} at {address}:{port} over mDNS")
+
+
+async def close() -> None:
+    """Withdraw the advertisement (app shutdown)."""
+    global _zeroconf
+    if _zeroconf is None:
+        return
+    await _zeroconf.async_unregister_service(_info)
+    await _zeroconf.async_close()
+    _zeroconf = None
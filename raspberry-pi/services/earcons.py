@@ -0,0 +1,174 @@
+"""
+Earcons - short sounds and common replies stored on the satellites
+
+Satellites keep these in flash and play them without a network round
+trip: prompt tones ("listening", "error") and replies the hub says often.
+The hub is the source of truth. Satellites download the set from
+GET /api/earcons and report what they hold, and a WebSocket reply then
+refers to a stored reply by ID instead of sending its audio.
+
+The set is:
+- built-in tones, generated into EARCON_DIR on first start (replace the
+  .wav files to change them)
+- any other 16 kHz mono 16-bit `<id>.wav` dropped into EARCON_DIR
+- reply sentences that have been spoken EARCON_PROMOTE_HITS times and
+  are at most EARCON_MAX_SECS long (at most EARCON_MAX_REPLIES of them)
+
+Audio is kept as raw PCM in the satellites' playback format; each entry
+carries a content hash, so satellites only download what changed.
+"""
+
+import hashlib
+import logging
+import math
+import os
+import re
+import sys
+import wave
+from array import array
+from pathlib import Path
+from typing import Optional
+
+from services import audio_codec
+
+log = logging.getLogger("voice-hub.earcons")
+
+SAMPLE_RATE = 16000
+
+PROMOTE_HITS = int(os.environ.get("EARCON_PROMOTE_HITS", "3"))
+MAX_SECS = float(os.environ.get("EARCON_MAX_SECS", "3"))
+MAX_REPLIES = int(os.environ.get("EARCON_MAX_REPLIES", "16"))
+
+REPLY_PREFIX = "r-"
+MAX_TRACKED = 1000       # Reply counts kept before starting over
+
+_VALID_ID = re.compile(r"^[a-z0-9_-]{1,23}$")   # Fits the firmware's EARCON_ID_LEN
+
+_directory: Optional[Path] = None
+_sounds: dict = {}       # id -> {"pcm": bytes, "hash": str}
+_reply_hits: dict = {}   # reply id -> times spoken
+version = 0              # Bumped whenever the set changes
+
+
+def _tone(segments: list) -> bytes:
+    """Render (frequency Hz, ms) segments, frequency 0 = silence, with soft edges."""
+    samples = array("h")
+    fade = SAMPLE_RATE * 5 // 1000    # 5 ms ramps, no clicks
+    for frequency, ms in segments:
+        count = SAMPLE_RATE * ms // 1000
+        for n in range(count):
+            level = min(1.0, n / fade, (count - 1 - n) / fade) if frequency else 0.0
+            samples.append(int(0.3 * 32767 * level * math.sin(2 * math.pi * frequency * n / SAMPLE_RATE)))
+    if sys.byteorder == "big":
+        samples.byteswap()
+    return samples.tobytes()
+
+
+BUILTIN_TONES = {
+    "listening": [(660, 70), (0, 20), (880, 90)],          # Rising: go ahead
+    "error": [(330, 120), (0, 60), (262, 160)],            # Falling: didn't work
+}
+
+
+def _content_hash(pcm: bytes) -> str:
+    return hashlib.sha1(pcm).hexdigest()[:8]
+
+
+def _read_wav(path: Path) -> Optional[bytes]:
+    with wave.open(str(path), "rb") as wav:
+        if (wav.getframerate(), wav.getnchannels(), wav.getsampwidth()) != (SAMPLE_RATE, 1, 2):
+            log.warning(f"Skipping {path.name}: earcons must be {SAMPLE_RATE} Hz mono 16-bit")
+            return None
+        return wav.readframes(wav.getnframes())
+
+
+def _write_wav(path: Path, pcm: bytes) -> None:
+    with wave.open(str(path), "wb") as wav:
+        wav.setnchannels(1)
+        wav.setsampwidth(2)
+        wav.setframerate(SAMPLE_RATE)
+        wav.writeframes(pcm)
+
+
+def _add(sound_id: str, pcm: bytes) -> None:
+    global version
+    _sounds[sound_id] = {"pcm": pcm, "hash": _content_hash(pcm)}
+    version += 1
+
+
+def load(directory: Path) -> None:
+    """Load the set from `directory`, creating the built-in tones (app startup)."""
+    global _directory
+    _directory = directory
+    _directory.mkdir(exist_ok=True)
+
+    for sound_id, segments in BUILTIN_TONES.items():
+        path = _directory / f"{sound_id}.wav"
+        if not path.exists():
+            _write_wav(path, _tone(segments))
+
+    for path in sorted(_directory.glob("*.wav")):
+        if not _VALID_ID.match(path.stem):
+            log.warning(f"Skipping {path.name}: IDs are lowercase letters, digits, - and _")
+            continue
+        try:
+            pcm = _read_wav(path)
+        except (OSError, wave.Error) as e:
+            log.warning(f"Skipping {path.name}: {e}")
+            continue
+        if pcm:
+            _add(path.stem, pcm)
+    log.info(f"Earcons: {len(_sounds)} sounds")
+
+
+def reply_id(text: str) -> str:
+    """The earcon ID a reply sentence gets once promoted."""
+    normalized = " ".join(text.split()).lower()
+    return REPLY_PREFIX + hashlib.sha1(normalized.encode()).hexdigest()[:10]
+
+
+def get(sound_id: str) -> Optional[dict]:
+    """{"pcm", "hash"} of a sound, or None."""
+    return _sounds.get(sound_id)
+
+
+def manifest() -> dict:
+    """The set as satellites see it: version, then ID, hash and size of each sound."""
+    return {
+        "version": version,
+        "earcons": [
+            {"id": sound_id, "hash": sound["hash"], "size": len(sound["pcm"])}
+            for sound_id, sound in sorted(_sounds.items())
+        ],
+    }
+
+
+def note_reply(text: str, pcm: bytes, sample_rate: int = SAMPLE_RATE) -> None:
+    """
+    Count a spoken reply sentence (`pcm` at `sample_rate`); promote it to
+    an earcon once it has been said often enough, if it's short. Earcons
+    are stored at SAMPLE_RATE, satellites convert during faster replies.
+    """
+    if _directory is None or not pcm or len(pcm) > MAX_SECS * sample_rate * 2:
+        return
+    sound_id = reply_id(text)
+    if sound_id in _sounds:
+        return
+
+    if len(_reply_hits) >= MAX_TRACKED and sound_id not in _reply_hits:
+        _reply_hits.clear()
+    _reply_hits[sound_id] = _reply_hits.get(sound_id, 0) + 1
+    if _reply_hits[sound_id] < PROMOTE_HITS:
+        return
+    if sum(1 for existing in _sounds if existing.startswith(REPLY_PREFIX)) >= MAX_REPLIES:
+        return
+    pcm = audio_codec.resample(pcm, sample_rate, SAMPLE_RATE)
+
+    try:
+        _write_wav(_directory / f"{sound_id}.wav", pcm)
+    except OSError as e:
+        log.error(f"Could not store earcon for \"{text}\": {e}")
+        return
+    _add(sound_id, pcm)
+    del _reply_hits[sound_id]
+    log.info(f"Promoted reply \"{text}\" to earcon {sound_id}")
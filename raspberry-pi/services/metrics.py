@@ -0,0 +1,215 @@
+"""
+Runtime Metrics - hub and satellite health in the Prometheus text format
+
+GET /metrics is scraped by Prometheus (or read with curl):
+- hub: HTTP requests by route and status, turns by transport and
+  pipeline, a latency histogram per pipeline stage, STT results per
+  backend, scheduler slots in use and turns queued per stage, and
+  satellites known / connected / active
+- satellites: the health each one reports every STATS_INTERVAL_MS of
+  its firmware (WiFi RSSI, free heap and PSRAM, I2S overruns and
+  underruns, reconnects), labelled with its ID
+
+Counters live in memory and start over with the hub; Prometheus'
+rate() and increase() handle the reset. Satellite counters are totals
+since the satellite booted, as reported.
+"""
+
+import math
+import time
+
+from services import satellites, scheduler, tts_cache
+
+# Upper bounds (seconds) of the stage histogram buckets
+STAGE_BUCKETS = (0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0)
+
+# Turn "timings" entries that count things rather than time them
+COUNT_TIMINGS = {"tts_cached", "earcons"}
+
+# Fields a satellite may report: name -> (type, help)
+SATELLITE_FIELDS = {
+    "uptime_seconds": ("gauge", "Seconds since the satellite booted"),
+    "rssi_dbm": ("gauge", "WiFi signal strength"),
+    "heap_free_bytes": ("gauge", "Free internal heap"),
+    "heap_min_free_bytes": ("gauge", "Lowest free internal heap since boot"),
+    "psram_free_bytes": ("gauge", "Free PSRAM"),
+    "turns": ("counter", "Turns taken since boot"),
+    "mic_overruns": ("counter", "Mic I2S DMA buffers overwritten before they were read"),
+    "capture_drop_bytes": ("counter", "Captured audio dropped because the capture ring was full"),
+    "playback_underruns": ("counter", "Times a reply ran dry and re-buffered"),
+    "dac_underflows": ("counter", "DAC I2S DMA buffers that ran out during a reply"),
+    "wifi_disconnects": ("counter", "WiFi link losses"),
+    "hub_connects": ("counter", "Connections opened to the hub"),
+    "uplink_bytes_per_second": ("gauge", "Uplink throughput the satellite picks its codec by"),
+}
+
+_started = time.time()
+_requests: dict = {}   # (method, route, status) -> count
+_turns: dict = {}      # (transport, pipeline) -> count
+_stt: dict = {}        # (backend, result) -> count
+_stages: dict = {}     # stage -> {"buckets": [count per bucket, cumulative], "sum": s, "count": n}
+
+
+def record_request(method: str, route: str, status: int) -> None:
+    key = (method, route, str(status))
+    _requests[key] = _requests.get(key, 0) + 1
+
+
+def record_stt(backend: str, ok: bool) -> None:
+    key = (backend, "ok" if ok else "error")
+    _stt[key] = _stt.get(key, 0) + 1
+
+
+def record_turn(transport: str, pipeline: str, timings: dict) -> None:
+    """Count a finished turn and add its hub stage timings (ms) to the histograms."""
+    key = (transport, pipeline)
+    _turns[key] = _turns.get(key, 0) + 1
+
+    for stage, ms in timings.items():
+        if stage in COUNT_TIMINGS or not isinstance(ms, (int, float)):
+            continue
+        seconds = ms / 1000
+        histogram = _stages.setdefault(stage, {"buckets": [0] * len(STAGE_BUCKETS), "sum": 0.0, "count": 0})
+        for i, bound in enumerate(STAGE_BUCKETS):
+            if seconds <= bound:
+                histogram["buckets"][i] += 1
+        histogram["sum"] += seconds
+        histogram["count"] += 1
+
+
+def satellite_stats(report: dict) -> dict:
+    """The known numeric fields of a satellite's stats report."""
+    return {
+        name: value for name, value in report.items()
+        if name in SATELLITE_FIELDS and isinstance(value, (int, float)) and not isinstance(value, bool)
+        and math.isfinite(value)
+    }
+
+
+class RequestMetrics:
+    """ASGI middleware counting HTTP requests by route template and status."""
+
+    def __init__(self, app):
+        self.app = app
+
+    async def __call__(self, scope, receive, send):
+        if scope["type"] != "http":
+            await self.app(scope, receive, send)
+            return
+
+        status = 500     # Unless a response is started
+
+        async def send_status(message):
+            nonlocal status
+            if message["type"] == "http.response.start":
+                status = message["status"]
+            await send(message)
+
+        try:
+            await self.app(scope, receive, send_status)
+        finally:
+            route = scope.get("route")   # Set by the router; keeps label values bounded
+            record_request(scope["method"], getattr(route, "path", "unmatched"), status)
+
+
+# ──────────────────────────────────────────────
+# EXPOSITION
+# ──────────────────────────────────────────────
+
+def _escape(value) -> str:
+    return str(value).replace("\\", "\\\\").replace('"', '\\"').replace("\n", "\\n")
+
+
+def _labels(**labels) -> str:
+    if not labels:
+        return ""
+    return "{" + ",".join(f'{name}="{_escape(value)}"' for name, value in labels.items()) + "}"
+
+
+def _number(value) -> str:
+    if isinstance(value, float) and value.is_integer():
+        return str(int(value))
+    return repr(value) if isinstance(value, float) else str(value)
+
+
+class _Writer:
+    def __init__(self):
+        self.lines = []
+
+    def family(self, name: str, kind: str, help_text: str) -> None:
+        self.lines.append(f"# HELP {name} {help_text}")
+        self.lines.append(f"# TYPE {name} {kind}")
+
+    def sample(self, name: str, value, **labels) -> None:
+        self.lines.append(f"{name}{_labels(**labels)} {_number(value)}")
+
+    def text(self) -> str:
+        return "\n".join(self.lines) + "\n"
+
+
+def render(version: str) -> str:
+    """Every metric, in the Prometheus text exposition format (version 0.0.4)."""
+    out = _Writer()
+
+    out.family("voice_hub_info", "gauge", "Hub version")
+    out.sample("voice_hub_info", 1, version=version)
+    out.family("voice_hub_start_time_seconds", "gauge", "When the hub started (Unix time)")
+    out.sample("voice_hub_start_time_seconds", round(_started, 3))
+
+    out.family("voice_hub_http_requests_total", "counter", "HTTP requests by route and status")
+    for (method, route, status), count in sorted(_requests.items()):
+        out.sample("voice_hub_http_requests_total", count, method=method, route=route, status=status)
+
+    out.family("voice_hub_turns_total", "counter", "Finished turns by transport and pipeline mode")
+    for (transport, pipeline), count in sorted(_turns.items()):
+        out.sample("voice_hub_turns_total", count, transport=transport, pipeline=pipeline)
+
+    out.family("voice_hub_stt_requests_total", "counter", "Speech-to-text results by backend")
+    for (backend, result), count in sorted(_stt.items()):
+        out.sample("voice_hub_stt_requests_total", count, backend=backend, result=result)
+
+    out.family("voice_hub_stage_seconds", "histogram", "Hub pipeline stage durations per turn")
+    for stage, histogram in sorted(_stages.items()):
+        for bound, count in zip(STAGE_BUCKETS, histogram["buckets"]):
+            out.sample("voice_hub_stage_seconds_bucket", count, stage=stage, le=_number(bound))
+        out.sample("voice_hub_stage_seconds_bucket", histogram["count"], stage=stage, le="+Inf")
+        out.sample("voice_hub_stage_seconds_sum", round(histogram["sum"], 6), stage=stage)
+        out.sample("voice_hub_stage_seconds_count", histogram["count"], stage=stage)
+
+    queues = scheduler.depth()
+    out.family("voice_hub_stage_slots_active", "gauge", "Scheduler slots in use per stage")
+    for stage, queue in sorted(queues.items()):
+        out.sample("voice_hub_stage_slots_active", queue["active"], stage=stage)
+    out.family("voice_hub_stage_slots_limit", "gauge", "Scheduler slots per stage")
+    for stage, queue in sorted(queues.items()):
+        out.sample("voice_hub_stage_slots_limit", queue["limit"], stage=stage)
+    out.family("voice_hub_stage_queue_depth", "gauge", "Turns waiting for a slot per stage")
+    for stage, queue in sorted(queues.items()):
+        out.sample("voice_hub_stage_queue_depth", queue["waiting"], stage=stage)
+
+    cache = tts_cache.stats()
+    out.family("voice_hub_tts_cache_entries", "gauge", "Phrases in the TTS cache per tier")
+    out.sample("voice_hub_tts_cache_entries", cache["memory_entries"], tier="memory")
+    out.sample("voice_hub_tts_cache_entries", cache["disk_entries"], tier="disk")
+    if cache["hit_rate"] is not None:
+        out.family("voice_hub_tts_cache_hit_ratio", "gauge", "Share of TTS cache lookups that hit")
+        out.sample("voice_hub_tts_cache_hit_ratio", cache["hit_rate"])
+
+    sessions = satellites.snapshot()
+    out.family("voice_hub_satellites", "gauge", "Satellites known, with an open WebSocket, and in a turn")
+    out.sample("voice_hub_satellites", len(sessions), state="known")
+    out.sample("voice_hub_satellites", sum(1 for s in sessions.values() if s["connected"]), state="connected")
+    out.sample("voice_hub_satellites", satellites.active_count(), state="active")
+
+    reports = {satellite: s["stats"] for satellite, s in sorted(sessions.items()) if s.get("stats")}
+    out.family("voice_satellite_stats_age_seconds", "gauge", "Seconds since the satellite last reported")
+    for satellite, stats in reports.items():
+        out.sample("voice_satellite_stats_age_seconds", stats["age_s"], satellite=satellite)
+    for field, (kind, help_text) in SATELLITE_FIELDS.items():
+        name = f"voice_satellite_{field}" + ("_total" if kind == "counter" else "")
+        out.family(name, kind, help_text)
+        for satellite, stats in reports.items():
+            if field in stats["values"]:
+                out.sample(name, stats["values"][field], satellite=satellite)
+
+    return out.text()
@@ -0,0 +1,112 @@
+"""
+Satellite Sessions - which satellites the hub knows and what they're doing
+
+Satellites identify themselves with an X-Satellite-ID header (their
+configured name, or "sat-" + WiFi MAC). That ID, not the IP address
+(DHCP hands those out again), keys telemetry, the recording archive and
+fair queuing in the scheduler. Firmware without the header is tracked by
+its address.
+
+Each session also keeps the last health report its satellite sent
+(RSSI, free memory, I2S and reconnect counters), exported on /metrics.
+
+Sessions are kept in memory for as long as the hub runs.
+"""
+
+import logging
+import re
+import time
+from typing import Optional
+
+log = logging.getLogger("voice-hub.satellites")
+
+# satellite ID -> session info
+_sessions: dict = {}
+
+
+def identify(header: Optional[str], address: str) -> str:
+    """The satellite's ID from its X-Satellite-ID header, else its address."""
+    satellite = re.sub(r"[^A-Za-z0-9._:-]", "", header or "")[:32]
+    return satellite or address
+
+
+def _session(satellite: str, address: str, transport: str) -> dict:
+    session = _sessions.get(satellite)
+    if session is None:
+        log.info(f"New satellite {satellite} at {address} ({transport})")
+        session = _sessions[satellite] = {
+            "address": address,
+            "transport": transport,
+            "connected": False,
+            "first_seen": time.time(),
+            "last_seen": time.time(),
+            "turns": 0,
+            "active_turns": 0,
+        }
+    elif session["address"] != address:
+        log.info(f"Satellite {satellite} moved from {session['address']} to {address}")
+    session.update(address=address, transport=transport, last_seen=time.time())
+    return session
+
+
+def connected(satellite: str, address: str) -> None:
+    """A satellite opened its WebSocket session."""
+    session = _session(satellite, address, "websocket")
+    if session["connected"]:
+        log.warning(f"Satellite {satellite} connected twice, is its ID unique?")
+    session["connected"] = True
+
+
+def disconnected(satellite: str) -> None:
+    """A satellite's WebSocket session ended."""
+    session = _sessions.get(satellite)
+    if session is not None:
+        session["connected"] = False
+        session["last_seen"] = time.time()
+
+
+def turn_started(satellite: str, address: str, transport: str) -> None:
+    """A turn from `satellite` reached the pipeline."""
+    session = _session(satellite, address, transport)
+    session["turns"] += 1
+    session["active_turns"] += 1
+
+
+def turn_finished(satellite: str) -> None:
+    """The turn's reply has been sent (or it failed)."""
+    session = _sessions.get(satellite)
+    if session is not None:
+        session["active_turns"] = max(0, session["active_turns"] - 1)
+        session["last_seen"] = time.time()
+
+
+def report_stats(satellite: str, address: str, transport: str, values: dict) -> None:
+    """Keep a satellite's latest health report."""
+    session = _session(satellite, address, transport)
+    session["stats"] = values
+    session["stats_time"] = time.time()
+
+
+def snapshot() -> dict:
+    """All known satellites and their session state."""
+    now = time.time()
+    return {
+        satellite: {
+            "address": session["address"],
+            "transport": session["transport"],
+            "connected": session["connected"],
+            "turns": session["turns"],
+            "active_turns": session["active_turns"],
+            "idle_secs": round(now - session["last_seen"], 1),
+            "stats": {
+                "age_s": round(now - session["stats_time"], 1),
+                "values": session["stats"],
+            } if "stats" in session else None,
+        }
+        for satellite, session in _sessions.items()
+    }
+
+
+def active_count() -> int:
+    """Satellites with a turn in progress."""
+    return sum(1 for session in _sessions.values() if session["active_turns"])
@@ -0,0 +1,118 @@
+"""
+Stage Scheduler - bounded, fair worker pools for the pipeline stages
+
+STT uploads, Claude and Piper each get a fixed number of slots. A turn
+waits for a slot before using the stage, so a burst from many rooms
+queues up instead of all hitting the same backend at once.
+
+Waiting turns are queued per satellite and slots are handed out round
+robin across satellites: a satellite with several queued sentences (or
+a stuck one retrying) gets one slot in turn with everyone else, and
+can't starve the other rooms. Within one satellite the order is FIFO,
+so its reply sentences are still synthesized in order.
+
+Pool sizes come from STT_WORKERS, AI_WORKERS and TTS_WORKERS.
+"""
+
+import asyncio
+import logging
+import os
+import time
+from collections import OrderedDict, deque
+from contextlib import asynccontextmanager
+from typing import Optional
+
+log = logging.getLogger("voice-hub.scheduler")
+
+STAGE_LIMITS = {
+    "stt": int(os.environ.get("STT_WORKERS", "4")),   # Whisper uploads, network bound
+    "ai": int(os.environ.get("AI_WORKERS", "2")),     # Claude CLI processes, CPU and RAM on the Pi
+    "tts": int(os.environ.get("TTS_WORKERS", "1")),   # One Piper process synthesizes one line at a time
+}
+
+
+class FairPool:
+    """A semaphore whose waiters are served round robin by satellite."""
+
+    def __init__(self, name: str, limit: int):
+        self.name = name
+        self.limit = max(1, limit)
+        self.active = 0
+        self._waiters: OrderedDict = OrderedDict()   # satellite -> deque of futures, in serving order
+
+    def waiting(self) -> int:
+        return sum(len(queue) for queue in self._waiters.values())
+
+    async def acquire(self, satellite: str) -> None:
+        if self.active < self.limit and not self._waiters:
+            self.active += 1
+            return
+
+        waiter = asyncio.get_running_loop().create_future()
+        self._waiters.setdefault(satellite, deque()).append(waiter)
+        try:
+            await waiter
+        except asyncio.CancelledError:
+            if waiter.done() and not waiter.cancelled():
+                self.release()   # Granted just as the turn was cancelled
+            else:
+                self._forget(satellite, waiter)
+            raise
+
+    def release(self) -> None:
+        self.active -= 1
+        while self.active < self.limit and self._waiters:
+            satellite, queue = next(iter(self._waiters.items()))
+            waiter = queue.popleft()
+            if queue:
+                self._waiters.move_to_end(satellite)   # Everyone else goes first next time
+            else:
+                del self._waiters[satellite]
+            if not waiter.done():
+                self.active += 1
+                waiter.set_result(None)
+
+    def _forget(self, satellite: str, waiter: asyncio.Future) -> None:
+        queue = self._waiters.get(satellite)
+        if queue is not None and waiter in queue:
+            queue.remove(waiter)
+            if not queue:
+                del self._waiters[satellite]
+
+
+_pools = {name: FairPool(name, limit) for name, limit in STAGE_LIMITS.items()}
+
+
+@asynccontextmanager
+async def slot(stage: str, satellite: str, timings: Optional[dict] = None):
+    """
+    Hold one of `stage`'s slots for the body of the `async with`.
+
+    Time spent queued is added to timings["<stage>_queue"] (ms) if given,
+    so a slow turn shows whether it was slow or just waiting.
+    """
+    pool = _pools[stage]
+    queued = time.time()
+    await pool.acquire(satellite)
+    waited = (time.time() - queued) * 1000
+    if waited >= 1:
+        log.info(f"{satellite} waited {waited:.0f} ms for {stage} ({pool.waiting()} still queued)")
+    if timings is not None:
+        timings[f"{stage}_queue"] = round(timings.get(f"{stage}_queue", 0) + waited, 1)
+    try:
+        yield
+    finally:
+        pool.release()
+
+
+def depth() -> dict:
+    """Per-stage slot usage and queue depth, with who is waiting."""
+    return {
+        name: {
+            "limit": pool.limit,
+            "active": pool.active,
+            "waiting": pool.waiting(),
+            "waiting_by_satellite": {sat: len(queue) for sat, queue in pool._waiters.items()},
+        }
+        for name, pool in _pools.items()
+    }
@@ -0,0 +1,128 @@
+"""
+Streaming STT Service - Deepgram live transcription
+
+Audio is sent to Deepgram's WebSocket API while the satellite is still
+uploading, so it has been transcribed by the time the upload ends; the
+end of the turn only has to flush the last fraction of a second
+(Finalize) instead of uploading and transcribing the whole file.
+
+Requires DEEPGRAM_API_KEY environment variable. Without it the hub uses
+the Whisper upload in stt_service.
+"""
+
+import asyncio
+import json
+import logging
+import os
+
+try:
+    from websockets.asyncio.client import connect  # websockets >= 13
+    _HEADERS_ARG = "additional_headers"
+except ImportError:
+    from websockets import connect
+    _HEADERS_ARG = "extra_headers"
+
+log = logging.getLogger("voice-hub.stt-stream")
+
+DEEPGRAM_API_KEY = os.environ.get("DEEPGRAM_API_KEY", "")
+DEEPGRAM_URL = "wss://api.deepgram.com/v1/listen"
+DEEPGRAM_MODEL = os.environ.get("DEEPGRAM_MODEL", "nova-2")
+
+FINALIZE_TIMEOUT = 3.0   # Seconds to wait for the last results after the upload ends
+KEEPALIVE_SECS = 5.0     # Deepgram closes after 10 s without audio (e.g. a long VAD pause)
+
+
+def is_available() -> bool:
+    """Check if the streaming STT service is configured."""
+    return bool(DEEPGRAM_API_KEY)
+
+
+class StreamingSession:
+    """
+    One utterance being transcribed as it arrives.
+
+    feed() never blocks: audio is queued and sent by a background task,
+    which also opens the connection, so the first frames can be fed
+    before Deepgram has even answered.
+    """
+
+    def __init__(self, sample_rate: int, channels: int = 1, language: str = "en"):
+        self._audio: asyncio.Queue = asyncio.Queue()
+        self._segments = []
+        self._finalized = asyncio.Event()
+        self._error = None
+        self._task = asyncio.ensure_future(self._run(sample_rate, channels, language))
+
+    def feed(self, pcm: bytes) -> None:
+        """Queue 16-bit little-endian PCM for transcription."""
+        if pcm and not self._task.done():
+            self._audio.put_nowait(pcm)
+
+    async def finish(self) -> str:
+        """
+        End the utterance and return its transcript.
+
+        Raises:
+            RuntimeError: If the connection failed or no result came back
+        """
+        self._audio.put_nowait(None)
+        try:
+            await asyncio.wait_for(asyncio.shield(self._task), timeout=FINALIZE_TIMEOUT)
+        except asyncio.TimeoutError:
+            self._task.cancel()
+            if not self._segments:
+                raise RuntimeError(f"Deepgram returned nothing within {FINALIZE_TIMEOUT:.0f}s")
+            log.warning("Deepgram did not confirm the flush, using the results so far")
+
+        if self._error is not None:
+            raise RuntimeError(f"Deepgram stream failed: {self._error}")
+        return " ".join(self._segments).strip()
+
+    def cancel(self) -> None:
+        """Drop the utterance (turn cancelled or satellite gone)."""
+        self._task.cancel()
+
+    async def _run(self, sample_rate: int, channels: int, language: str):
+        url = (
+            f"{DEEPGRAM_URL}?encoding=linear16&sample_rate={sample_rate}&channels={channels}"
+            f"&model={DEEPGRAM_MODEL}&language={language}&punctuate=true&smart_format=true"
+        )
+        headers = {"Authorization": f"Token {DEEPGRAM_API_KEY}"}
+
+        try:
+            async with connect(url, **{_HEADERS_ARG: headers}) as ws:
+                receiver = asyncio.ensure_future(self._receive(ws))
+                try:
+                    while True:
+                        try:
+                            chunk = await asyncio.wait_for(self._audio.get(), timeout=KEEPALIVE_SECS)
+                        except asyncio.TimeoutError:
+                            await ws.send(json.dumps({"type": "KeepAlive"}))
+                            continue
+                        if chunk is None:
+                            break
+                        await ws.send(chunk)
+
+                    # Flush what Deepgram still holds, then wait for it
+                    await ws.send(json.dumps({"type": "Finalize"}))
+                    await self._finalized.wait()
+                    await ws.send(json.dumps({"type": "CloseStream"}))
+                finally:
+                    receiver.cancel()
+        except Exception as e:
+            log.error(f"Deepgram stream error: {e}")
+            self._error = e
+
+    async def _receive(self, ws):
+        try:
+            async for raw in ws:
+                message = json.loads(raw)
+                if message.get("type") != "Results":
+                    continue
+                text = message["channel"]["alternatives"][0]["transcript"]
+                if message.get("is_final") and text:
+                    self._segments.append(text)
+                if message.get("from_finalize"):
+                    self._finalized.set()
+        finally:
+            self._finalized.set()  # Connection closed, nothing more is coming
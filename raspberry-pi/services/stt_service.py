@@ -3,8 +3,18 @@ Cloud STT Service - OpenAI Whisper API
 
 Sends audio to OpenAI's Whisper API for speech-to-text transcription.
 Requires OPENAI_API_KEY environment variable.
+
+All requests share one long-lived httpx client (opened at app startup,
+see start()/close()), so turns reuse warm keep-alive / HTTP/2 connections
+instead of paying a TLS handshake each time. Pool limits are configurable
+with STT_MAX_CONNECTIONS, STT_MAX_KEEPALIVE, STT_KEEPALIVE_EXPIRY and
+STT_HTTP2.
+
+The WAV is uploaded straight from the buffer the hub received it in:
+multipart reads it through a file-like view instead of a bytes copy.
 """
 
+import io
 import os
 import logging
 import httpx
@@ -15,18 +25,107 @@ OPENAI_API_KEY = os.environ.get("OPENAI_API_KEY", "")
 WHISPER_URL = "https://api.openai.com/v1/audio/transcriptions"
 WHISPER_MODEL = "whisper-1"
 
+MAX_CONNECTIONS = int(os.environ.get("STT_MAX_CONNECTIONS", "10"))      # Concurrent requests to the API
+MAX_KEEPALIVE = int(os.environ.get("STT_MAX_KEEPALIVE", "5"))           # Idle connections kept warm
+KEEPALIVE_EXPIRY = float(os.environ.get("STT_KEEPALIVE_EXPIRY", "120"))  # Seconds an idle connection is kept
+HTTP2 = os.environ.get("STT_HTTP2", "1") != "0"
+POOL_TIMEOUT = 10.0  # Seconds a request waits for a free connection
+
+_client = None
+
+
+def _create_client() -> httpx.AsyncClient:
+    http2 = HTTP2
+    if http2:
+        try:
+            import h2  # noqa: F401 - httpx needs it for HTTP/2
+        except ImportError:
+            log.warning("h2 not installed (pip install 'httpx[http2]'), using HTTP/1.1")
+            http2 = False
+
+    return httpx.AsyncClient(
+        http2=http2,
+        timeout=httpx.Timeout(30.0, pool=POOL_TIMEOUT),
+        limits=httpx.Limits(
+            max_connections=MAX_CONNECTIONS,
+            max_keepalive_connections=MAX_KEEPALIVE,
+            keepalive_expiry=KEEPALIVE_EXPIRY,
+        ),
+    )
+
+
+async def start() -> None:
+    """Open the shared client and warm up a connection to the API."""
+    global _client
+    if _client is None:
+        _client = _create_client()
+    if not OPENAI_API_KEY:
+        return
+
+    # Any response will do, it's the TCP + TLS setup we're after
+    try:
+        await _client.get(WHISPER_URL.rsplit("/audio/", 1)[0] + "/models",
+                          headers={"Authorization": f"Bearer {OPENAI_API_KEY}"})
+        log.info("Connection to Whisper API warmed up")
+    except httpx.HTTPError as e:
+        log.warning(f"Could not warm up Whisper API connection: {e}")
+
+
+async def close() -> None:
+    """Close the shared client (app shutdown)."""
+    global _client
+    if _client is not None:
+        await _client.aclose()
+        _client = None
+
+
+def _get_client() -> httpx.AsyncClient:
+    global _client
+    if _client is None:  # Used without the app's startup hook
+        _client = _create_client()
+    return _client
+
+
+class _BufferReader(io.RawIOBase):
+    """Read-only, seekable file over a bytes-like object, without copying it."""
+
+    def __init__(self, buffer):
+        self._view = memoryview(buffer).cast("B")
+        self._position = 0
+
+    def readable(self) -> bool:
+        return True
+
+    def seekable(self) -> bool:
+        return True
+
+    def tell(self) -> int:
+        return self._position
+
+    def seek(self, offset: int, whence: int = io.SEEK_SET) -> int:
+        base = {io.SEEK_SET: 0, io.SEEK_CUR: self._position, io.SEEK_END: len(self._view)}[whence]
+        self._position = min(max(base + offset, 0), len(self._view))
+        return self._position
+
+    def readinto(self, buffer) -> int:
+        chunk = self._view[self._position:self._position + len(buffer)]
+        buffer[:len(chunk)] = chunk
+        self._position += len(chunk)
+        return len(chunk)
+
 
 def is_available() -> bool:
     """Check if the STT service is configured."""
     return bool(OPENAI_API_KEY)
 
 
-async def transcribe(audio_bytes: bytes, language: str = "en") -> str:
+async def transcribe(audio, language: str = "en") -> str:
     """
     Send WAV audio to OpenAI Whisper API and return transcription text.
 
     Args:
-        audio_bytes: Raw WAV file bytes (with header)
+        audio: The WAV file (with header), any bytes-like object; it is
+            read in place, so it mustn't change until this returns
         language: Language hint for Whisper (ISO 639-1 code)
 
     Returns:
@@ -41,19 +140,18 @@ async def transcribe(audio_bytes: bytes, language: str = "en") -> str:
             "  export OPENAI_API_KEY='sk-...'"
         )
 
-    log.info(f"Sending {len(audio_bytes)} bytes to Whisper API (model={WHISPER_MODEL})")
-
-    async with httpx.AsyncClient(timeout=30.0) as client:
-        response = await client.post(
-            WHISPER_URL,
-            headers={"Authorization": f"Bearer {OPENAI_API_KEY}"},
-            files={"file": ("recording.wav", audio_bytes, "audio/wav")},
-            data={
-                "model": WHISPER_MODEL,
-                "language": language,
-                "response_format": "text",
-            },
-        )
+    log.info(f"Sending {len(audio)} bytes to Whisper API (model={WHISPER_MODEL})")
+
+    response = await _get_client().post(
+        WHISPER_URL,
+        headers={"Authorization": f"Bearer {OPENAI_API_KEY}"},
+        files={"file": ("recording.wav", _BufferReader(audio), "audio/wav")},
+        data={
+            "model": WHISPER_MODEL,
+            "language": language,
+            "response_format": "text",
+        },
+    )
 
     if response.status_code != 200:
         error_detail = response.text[:500]
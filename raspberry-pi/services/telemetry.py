@@ -0,0 +1,104 @@
+"""
+Turn Telemetry - per-stage latency of satellite turns
+
+Every turn is timed from both ends. The hub records its own stages
+(upload, decode, STT, ...) when the pipeline finishes; the satellite
+reports its milestones (first sample, upload end, first DAC write, ...)
+once the reply has played. Both carry the satellite's turn ID and are
+joined here, so one slow turn can be followed end to end and the fleet
+summarised as p50/p95 per stage.
+
+Only the most recent turns are kept, in memory.
+"""
+
+import logging
+from collections import OrderedDict
+from typing import Optional
+
+log = logging.getLogger("voice-hub.telemetry")
+
+MAX_TURNS = 500
+
+# (satellite, turn_id) -> {"satellite": {stage: ms}, "hub": {stage: ms}}
+_turns: OrderedDict = OrderedDict()
+
+
+def _turn(satellite: str, turn_id: str) -> dict:
+    key = (satellite, turn_id)
+    turn = _turns.get(key)
+    if turn is None:
+        turn = _turns[key] = {"satellite": {}, "hub": {}}
+        while len(_turns) > MAX_TURNS:
+            _turns.popitem(last=False)
+    return turn
+
+
+def record_hub(satellite: str, turn_id: Optional[str], stages: dict) -> None:
+    """Store the hub's stage durations (ms) for a turn."""
+    if turn_id:
+        _turn(satellite, turn_id)["hub"].update(stages)
+
+
+def record_satellite(satellite: str, turn_id: Optional[str], stages: dict) -> None:
+    """Store a satellite's milestone offsets (ms after the press) for a turn."""
+    if not turn_id:
+        return
+    turn = _turn(satellite, turn_id)
+    turn["satellite"].update(stages)
+    log.info(
+        f"Turn {turn_id} from {satellite}: "
+        + " ".join(f"{name}={ms}" for name, ms in turn["satellite"].items())
+        + " | hub: "
+        + " ".join(f"{name}={ms}" for name, ms in turn["hub"].items())
+    )
+
+
+def parse_timing_header(value: str) -> tuple[Optional[str], dict]:
+    """
+    Parse the X-Prev-Turn-Timing header HTTP satellites send:
+    "id=<turn_id>;first_sample=12;upload_start=40;..." (ms after the press).
+
+    Returns (turn_id, stages). Malformed fields are skipped.
+    """
+    turn_id = None
+    stages = {}
+    for field in value.split(";"):
+        name, _, raw = field.strip().partition("=")
+        if name == "id":
+            turn_id = raw or None
+        elif name and raw:
+            try:
+                stages[name] = float(raw)
+            except ValueError:
+                continue
+    return turn_id, stages
+
+
+def server_timing(stages: dict) -> str:
+    """Format hub stage durations (ms) as a Server-Timing header value."""
+    return ", ".join(f"{name};dur={ms:.1f}" for name, ms in stages.items())
+
+
+def _percentile(values: list, fraction: float) -> float:
+    """Nearest-rank percentile of a sorted list."""
+    index = max(0, min(len(values) - 1, round(fraction * len(values) + 0.5) - 1))
+    return values[index]
+
+
+def summary() -> dict:
+    """p50/p95 of every stage over the recent turns, satellite and hub side."""
+    samples: dict[str, list] = {}
+    for turn in _turns.values():
+        for side in ("satellite", "hub"):
+            for name, ms in turn[side].items():
+                samples.setdefault(f"{side}.{name}", []).append(ms)
+
+    stages = {}
+    for name, values in sorted(samples.items()):
+        values.sort()
+        stages[name] = {
+            "count": len(values),
+            "p50": _percentile(values, 0.50),
+            "p95": _percentile(values, 0.95),
+        }
+    return {"turns": len(_turns), "stages": stages}
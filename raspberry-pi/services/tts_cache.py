@@ -0,0 +1,187 @@
+"""
+TTS Cache - synthesized reply audio, reused for repeated phrases
+
+Many replies are the same short phrases ("Okay.", "Timer set.", error
+messages). Their PCM is kept under a hash of text + voice + sample rate,
+so a repeat is sent straight away instead of waiting for Piper.
+
+Recently used phrases stay in memory; entries pushed out of memory (and
+everything still in memory at shutdown) are spilled to disk and read
+back on the next hit, so the cache survives restarts. Both tiers are
+LRU-bounded by size. Long sentences are rarely repeated and aren't cached.
+
+Configured with TTS_CACHE_ENABLED, TTS_CACHE_MEMORY_MB, TTS_CACHE_DISK_MB
+and TTS_CACHE_MAX_CHARS.
+"""
+
+import asyncio
+import hashlib
+import logging
+import os
+from collections import OrderedDict
+from pathlib import Path
+from typing import Optional
+
+log = logging.getLogger("voice-hub.tts-cache")
+
+ENABLED = os.environ.get("TTS_CACHE_ENABLED", "1") != "0"
+MEMORY_BYTES = int(float(os.environ.get("TTS_CACHE_MEMORY_MB", "32")) * 1024 * 1024)
+DISK_BYTES = int(float(os.environ.get("TTS_CACHE_DISK_MB", "256")) * 1024 * 1024)
+MAX_CHARS = int(os.environ.get("TTS_CACHE_MAX_CHARS", "200"))
+
+_directory: Optional[Path] = None
+_memory: OrderedDict = OrderedDict()   # key -> PCM, least recently used first
+_memory_bytes = 0
+_disk: OrderedDict = OrderedDict()     # key -> size of the spilled file, least recently used first
+_disk_bytes = 0
+_spilling: dict = {}                   # key -> PCM of spill writes in flight
+_spills: set = set()
+_hits = 0
+_misses = 0
+
+
+def key(text: str, voice: str, sample_rate: int) -> Optional[str]:
+    """Cache key for one sentence, or None if it shouldn't be cached."""
+    if not ENABLED or len(text) > MAX_CHARS:
+        return None
+    return hashlib.sha256(f"{voice}\n{sample_rate}\n{text}".encode()).hexdigest()
+
+
+def _path(cache_key: str) -> Path:
+    return _directory / cache_key[:2] / f"{cache_key}.pcm"
+
+
+def _scan(directory: Path) -> list:
+    """Spilled entries from earlier runs, oldest first."""
+    found = []
+    for path in directory.glob("*/*.pcm"):
+        stat = path.stat()
+        found.append((stat.st_mtime, path.stem, stat.st_size))
+    return sorted(found)
+
+
+def _write(path: Path, pcm: bytes, stale: list) -> None:
+    """Runs in a worker thread: write one entry, remove evicted ones."""
+    path.parent.mkdir(exist_ok=True)
+    temp = path.with_suffix(".tmp")
+    temp.write_bytes(pcm)
+    temp.replace(path)   # Readers never see a half-written file
+    for old in stale:
+        old.unlink(missing_ok=True)
+
+
+async def start(directory: Path) -> None:
+    """Load the index of spilled entries (app startup)."""
+    global _directory, _disk_bytes
+    if not ENABLED:
+        log.info("TTS cache disabled")
+        return
+
+    _directory = directory
+    _directory.mkdir(exist_ok=True)
+    for _, cache_key, size in await asyncio.to_thread(_scan, _directory):
+        _disk[cache_key] = size
+        _disk_bytes += size
+    log.info(f"TTS cache: {len(_disk)} phrases on disk ({_disk_bytes / 1024 / 1024:.1f} MB)")
+
+
+async def close() -> None:
+    """Spill what's only in memory so it's kept across restarts (app shutdown)."""
+    for cache_key, pcm in list(_memory.items()):
+        if cache_key not in _disk and cache_key not in _spilling:
+            _spill(cache_key, pcm)
+    if _spills:
+        await asyncio.gather(*_spills, return_exceptions=True)
+
+
+async def get(cache_key: Optional[str]) -> Optional[bytes]:
+    """The cached PCM for `cache_key`, or None on a miss."""
+    global _hits, _misses
+    if cache_key is None or _directory is None:
+        return None
+
+    pcm = _memory.get(cache_key) or _spilling.get(cache_key)
+    if cache_key in _memory:
+        _memory.move_to_end(cache_key)
+    elif cache_key in _disk:
+        try:
+            pcm = await asyncio.to_thread(_path(cache_key).read_bytes)
+        except OSError as e:
+            log.warning(f"Dropping unreadable TTS cache entry: {e}")
+            _forget_spilled(cache_key)
+        else:
+            _disk.move_to_end(cache_key)
+            _remember(cache_key, pcm)
+
+    if pcm is None:
+        _misses += 1
+    else:
+        _hits += 1
+    return pcm
+
+
+def put(cache_key: Optional[str], pcm: bytes) -> None:
+    """Cache freshly synthesized PCM."""
+    if cache_key is None or _directory is None or not pcm or cache_key in _memory:
+        return
+    _remember(cache_key, pcm)
+
+
+def stats() -> dict:
+    """Entry counts, sizes and hit rate, for /api/health."""
+    lookups = _hits + _misses
+    return {
+        "memory_entries": len(_memory),
+        "memory_mb": round(_memory_bytes / 1024 / 1024, 1),
+        "disk_entries": len(_disk),
+        "disk_mb": round(_disk_bytes / 1024 / 1024, 1),
+        "hit_rate": round(_hits / lookups, 3) if lookups else None,
+    }
+
+
+def _remember(cache_key: str, pcm: bytes) -> None:
+    global _memory_bytes
+    _memory[cache_key] = pcm
+    _memory_bytes += len(pcm)
+    while _memory_bytes > MEMORY_BYTES and len(_memory) > 1:
+        old_key, old_pcm = _memory.popitem(last=False)
+        _memory_bytes -= len(old_pcm)
+        if old_key not in _disk and old_key not in _spilling:
+            _spill(old_key, old_pcm)
+
+
+def _spill(cache_key: str, pcm: bytes) -> None:
+    """Write an entry to disk in the background, evicting the oldest spilled ones."""
+    global _disk_bytes
+    if len(pcm) > DISK_BYTES:
+        return
+    stale = []
+    while _disk and _disk_bytes + len(pcm) > DISK_BYTES:
+        old_key, old_size = _disk.popitem(last=False)
+        _disk_bytes -= old_size
+        stale.append(_path(old_key))
+
+    # Indexed only once written, so a concurrent get() never reads a missing
+    # file; until then get() is served from _spilling
+    async def write():
+        global _disk_bytes
+        try:
+            await asyncio.to_thread(_write, _path(cache_key), pcm, stale)
+        except OSError as e:
+            log.error(f"Could not spill TTS cache entry: {e}")
+            return
+        finally:
+            _spilling.pop(cache_key, None)
+        _disk[cache_key] = len(pcm)
+        _disk_bytes += len(pcm)
+
+    _spilling[cache_key] = pcm
+
+    task = asyncio.ensure_future(write())
+    _spills.add(task)
+    task.add_done_callback(_spills.discard)
+
+
+def _forget_spilled(cache_key: str) -> None:
+    global _disk_bytes
+    _disk_bytes -= _disk.pop(cache_key, 0)
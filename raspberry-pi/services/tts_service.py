@@ -0,0 +1,156 @@
+"""
+TTS Service - Piper
+
+Synthesizes reply sentences with Piper (local neural TTS). One Piper
+process is kept running with the voice loaded, fed one line of text per
+sentence; in --output_dir mode it writes a WAV per line and prints its
+path. Loading the model per sentence would cost more than synthesizing it.
+
+Output is mono 16-bit PCM at the rate the caller asks for: the voice's
+native rate when the satellite can play it (reply_rate()), so nothing is
+resampled, else 16 kHz. Synthesized sentences are kept in tts_cache per
+rate; call cached() before queueing a sentence for synthesize().
+
+Requires PIPER_MODEL (path to the .onnx voice, its .onnx.json next to it)
+and the `piper` binary on PATH (or PIPER_BIN).
+"""
+
+import asyncio
+import json
+import logging
+import os
+import shutil
+import tempfile
+import wave
+from pathlib import Path
+from typing import Optional
+
+from services import audio_codec, tts_cache
+
+log = logging.getLogger("voice-hub.tts")
+
+PIPER_BIN = os.environ.get("PIPER_BIN", "piper")
+PIPER_MODEL = os.environ.get("PIPER_MODEL", "")
+TTS_TIMEOUT = float(os.environ.get("TTS_TIMEOUT", "30"))
+
+OUTPUT_SAMPLE_RATE = 16000   # Default reply rate, the one every satellite can play
+
+_process = None
+_output_dir = None
+_lock = None             # Created on first use, inside the server's event loop
+_voice = None            # Identifies the loaded voice in cache keys
+_native_rate = None      # The voice's own sample rate, from its .onnx.json
+
+
+def is_available() -> bool:
+    """Check if Piper and a voice model are installed."""
+    return bool(PIPER_MODEL) and Path(PIPER_MODEL).exists() and shutil.which(PIPER_BIN) is not None
+
+
+def _line(text: str) -> str:
+    """Piper reads one utterance per line."""
+    return " ".join(text.split())
+
+
+def native_rate() -> int:
+    """The rate Piper synthesizes the voice at (OUTPUT_SAMPLE_RATE if unknown)."""
+    global _native_rate
+    if _native_rate is None:
+        try:
+            config = json.loads(Path(f"{PIPER_MODEL}.json").read_text())
+            _native_rate = int(config["audio"]["sample_rate"])
+        except (OSError, ValueError, KeyError, TypeError) as e:
+            log.warning(f"Voice sample rate unknown ({e!r}), replies are resampled to {OUTPUT_SAMPLE_RATE} Hz")
+            _native_rate = OUTPUT_SAMPLE_RATE
+    return _native_rate
+
+
+def reply_rate(playback_rates: set) -> int:
+    """The rate to send replies at to a satellite that can play `playback_rates`."""
+    if is_available() and native_rate() in playback_rates:
+        return native_rate()
+    return OUTPUT_SAMPLE_RATE
+
+
+def _cache_key(line: str, sample_rate: int) -> Optional[str]:
+    # The model's size and mtime change when the voice file is replaced
+    global _voice
+    if _voice is None:
+        stat = Path(PIPER_MODEL).stat()
+        _voice = f"{Path(PIPER_MODEL).name}:{stat.st_size}:{int(stat.st_mtime)}"
+    return tts_cache.key(line, _voice, sample_rate)
+
+
+async def _ensure_process():
+    """Start the Piper process (again, if it died)."""
+    global _process, _output_dir
+    if _process is not None and _process.returncode is None:
+        return _process
+
+    if _output_dir is None:
+        _output_dir = tempfile.mkdtemp(prefix="piper-")
+    log.info(f"Starting Piper with {PIPER_MODEL}")
+    _process = await asyncio.create_subprocess_exec(
+        PIPER_BIN, "--model", PIPER_MODEL, "--output_dir", _output_dir,
+        stdin=asyncio.subprocess.PIPE,
+        stdout=asyncio.subprocess.PIPE,
+        stderr=asyncio.subprocess.DEVNULL,
+    )
+    return _process
+
+
+def _read_pcm(path: Path, sample_rate: int) -> bytes:
+    """Read a Piper WAV and return it as mono 16-bit PCM at `sample_rate`."""
+    with wave.open(str(path), "rb") as wav:
+        rate = wav.getframerate()
+        pcm = wav.readframes(wav.getnframes())
+    path.unlink(missing_ok=True)
+    return audio_codec.resample(pcm, rate, sample_rate)
+
+
+async def cached(text: str, sample_rate: int = OUTPUT_SAMPLE_RATE) -> Optional[bytes]:
+    """The PCM for `text` at `sample_rate` if it has been synthesized before, else None."""
+    line = _line(text)
+    if not line or not is_available():
+        return None
+    return await tts_cache.get(_cache_key(line, sample_rate))
+
+
+async def synthesize(text: str, sample_rate: int = OUTPUT_SAMPLE_RATE) -> bytes:
+    """
+    Speak one sentence.
+
+    Returns mono 16-bit little-endian PCM at `sample_rate` (no WAV header).
+
+    Raises:
+        RuntimeError: If Piper is not configured, dies or times out
+    """
+    if not is_available():
+        raise RuntimeError("Piper not configured. Set PIPER_MODEL to a voice .onnx file")
+
+    line = _line(text)
+    if not line:
+        return b""
+
+    global _lock
+    if _lock is None:
+        _lock = asyncio.Lock()
+
+    async with _lock:
+        process = await _ensure_process()
+        try:
+            process.stdin.write(line.encode() + b"\n")
+            await process.stdin.drain()
+            output = await asyncio.wait_for(process.stdout.readline(), timeout=TTS_TIMEOUT)
+        except (asyncio.TimeoutError, BrokenPipeError, ConnectionResetError) as e:
+            process.kill()
+            raise RuntimeError(f"Piper failed: {e!r}")
+
+        if not output:
+            raise RuntimeError("Piper exited")
+
+    pcm = await asyncio.get_running_loop().run_in_executor(
+        None, _read_pcm, Path(output.decode().strip()), sample_rate
+    )
+    tts_cache.put(_cache_key(line, sample_rate), pcm)
+    return pcm
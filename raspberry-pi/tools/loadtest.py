@@ -0,0 +1,404 @@
+"""
+Hub Load Test - many virtual satellites replaying real recordings
+
+Each virtual satellite takes turns like a real one: it waits a random
+think time, "presses the button" and uploads a recording from the
+archive (received_audio/) at real-time pace, as the firmware streams
+while the button is held, then reads the reply to the end. HTTP
+satellites POST to /api/voice with chunked encoding. WebSocket
+satellites hold one /ws/voice session and send start / audio / end.
+
+Per turn it records:
+- upload: press until the last audio byte
+- first_reply: release until the first reply byte (what the user waits for)
+- reply_total: release until the reply has fully arrived
+- processing: the hub's X-Processing-Time (or "processing_time" over WebSocket)
+- hub stages: Server-Timing (HTTP) or the result's "timings" (WebSocket)
+
+and prints count / p50 / p95 / p99 / max for each, per transport. The
+hub timings that count things (sentences from the TTS cache, earcons
+sent) are summed per transport instead. Run the same load before and
+after a hub change and compare.
+
+Usage (from raspberry-pi/, with the hub running):
+    python tools/loadtest.py --satellites 8 --turns 5
+    python tools/loadtest.py --transport websocket --satellites 20 --duration 300 --json run.json
+
+Needs httpx and websockets (both in requirements.txt). Turns are real
+turns: they use STT, Claude and Piper like any other.
+"""
+
+import argparse
+import asyncio
+import gzip
+import json
+import random
+import struct
+import sys
+import time
+from pathlib import Path
+from typing import Optional
+
+import httpx
+import websockets
+
+WAV_STREAMING_SIZE = 0xFFFFFFFF  # data size in recordings streamed while recording
+CHUNK_MS = 64                    # Upload pacing, about what the firmware sends per chunk
+FORMAT_PCM = 1
+FORMAT_IMA_ADPCM = 0x11
+COUNT_STAGES = {"tts_cached", "earcons"}   # Hub "timings" that are counts, not ms (as in services/metrics.py)
+
+
+# ============================================================
+# RECORDINGS
+# ============================================================
+
+def parse_wav(data: bytes) -> Optional[dict]:
+    """Format fields and audio data of a PCM or IMA-ADPCM WAV, or None."""
+    if len(data) < 12 or data[0:4] != b"RIFF" or data[8:12] != b"WAVE":
+        return None
+    fmt = None
+    offset = 12
+    while offset + 8 <= len(data):
+        chunk_id = data[offset:offset + 4]
+        size = struct.unpack_from("<I", data, offset + 4)[0]
+        body = offset + 8
+        if chunk_id == b"fmt " and size >= 16:
+            tag, channels, rate, byte_rate, block_align, bits = struct.unpack_from("<HHIIHH", data, body)
+            fmt = {"tag": tag, "channels": channels, "sample_rate": rate, "byte_rate": byte_rate,
+                   "block_align": block_align, "bits_per_sample": bits}
+        elif chunk_id == b"data":
+            if fmt is None or fmt["tag"] not in (FORMAT_PCM, FORMAT_IMA_ADPCM):
+                return None
+            end = len(data) if size == WAV_STREAMING_SIZE else min(len(data), body + size)
+            return {**fmt, "header": data[:body], "audio": data[body:end]}
+        offset = body + size + (size & 1)
+    return None
+
+
+def load_recordings(directory: Path, limit: int) -> list:
+    """Recordings from the archive (received_audio/<satellite>/*.wav[.gz])."""
+    recordings = []
+    for path in sorted(directory.rglob("*.wav*")):
+        if path.suffix not in (".wav", ".gz"):
+            continue
+        try:
+            data = path.read_bytes()
+            if path.suffix == ".gz":
+                data = gzip.decompress(data)
+        except OSError as e:
+            print(f"Skipping {path}: {e}", file=sys.stderr)
+            continue
+        wav = parse_wav(data)
+        if wav is None or not wav["audio"] or not wav["byte_rate"]:
+            continue
+        recordings.append({"name": str(path.relative_to(directory)), **wav})
+        if len(recordings) >= limit:
+            break
+    return recordings
+
+
+async def paced(audio: bytes, byte_rate: int, realtime: bool):
+    """The recording in CHUNK_MS pieces, at the rate it was spoken."""
+    chunk = max(1, byte_rate * CHUNK_MS // 1000)
+    started = time.monotonic()
+    for offset in range(0, len(audio), chunk):
+        if realtime:
+            due = started + offset / byte_rate
+            delay = due - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+        yield audio[offset:offset + chunk]
+
+
+# ============================================================
+# TURNS
+# ============================================================
+
+def parse_server_timing(value: str) -> dict:
+    """"stt;dur=812.4, stt_queue;dur=3.1" -> {"stt": 812.4, "stt_queue": 3.1}"""
+    stages = {}
+    for entry in value.split(","):
+        name, _, params = entry.strip().partition(";")
+        for param in params.split(";"):
+            key, _, raw = param.strip().partition("=")
+            if name and key == "dur":
+                try:
+                    stages[name] = float(raw)
+                except ValueError:
+                    pass
+    return stages
+
+
+async def http_turn(client: httpx.AsyncClient, hub: str, satellite: str, turn_id: str,
+                    recording: dict, args) -> dict:
+    """One push-to-talk turn over POST /api/voice."""
+    pressed = time.monotonic()
+    released = pressed
+
+    async def body():
+        nonlocal released
+        yield recording["header"]
+        async for chunk in paced(recording["audio"], recording["byte_rate"], args.realtime):
+            yield chunk
+        released = time.monotonic()
+
+    headers = {
+        "Content-Type": "audio/wav",
+        "X-Satellite-ID": satellite,
+        "X-Turn-ID": turn_id,
+        "X-Playback-Rates": args.playback_rates,
+    }
+    request = client.build_request("POST", f"{hub}/api/voice", content=body(), headers=headers)
+    response = await client.send(request, stream=True)
+    first = None
+    size = 0
+    try:
+        async for data in response.aiter_bytes():
+            if first is None and data:
+                first = time.monotonic()
+            size += len(data)
+    finally:
+        await response.aclose()
+    done = time.monotonic()
+
+    if response.status_code != 200:
+        raise RuntimeError(f"HTTP {response.status_code}")
+    turn = {
+        "upload": (released - pressed) * 1000,
+        "first_reply": ((first or done) - released) * 1000,
+        "reply_total": (done - released) * 1000,
+        "reply_bytes": size,
+        "stages": parse_server_timing(response.headers.get("server-timing", "")),
+    }
+    if "x-processing-time" in response.headers:
+        turn["processing"] = float(response.headers["x-processing-time"]) * 1000
+    return turn
+
+
+async def ws_connect(url: str, headers: dict):
+    # websockets renamed extra_headers with its new client (14.0)
+    try:
+        return await websockets.connect(url, additional_headers=headers, max_size=None)
+    except TypeError:
+        return await websockets.connect(url, extra_headers=headers, max_size=None)
+
+
+async def ws_turn(socket, turn_id: str, recording: dict, args) -> dict:
+    """One turn over an open /ws/voice session."""
+    adpcm = recording["tag"] == FORMAT_IMA_ADPCM
+    start = {
+        "type": "start",
+        "turn_id": turn_id,
+        "codec": "ima_adpcm" if adpcm else "pcm",
+        "sample_rate": recording["sample_rate"],
+        "channels": recording["channels"],
+    }
+    start.update({"block_align": recording["block_align"]} if adpcm
+                 else {"bits_per_sample": recording["bits_per_sample"]})
+
+    pressed = time.monotonic()
+    await socket.send(json.dumps(start))
+    async for chunk in paced(recording["audio"], recording["byte_rate"], args.realtime):
+        await socket.send(chunk)
+    await socket.send(json.dumps({"type": "end"}))
+    released = time.monotonic()
+
+    first = None
+    size = 0
+    while True:
+        message = await asyncio.wait_for(socket.recv(), args.timeout)
+        if isinstance(message, bytes):
+            if first is None:
+                first = time.monotonic()
+            size += len(message)
+            continue
+        control = json.loads(message)
+        if control.get("turn_id") not in (None, turn_id):
+            continue     # Late message from an earlier turn
+        kind = control.get("type")
+        if kind == "earcons":
+            await socket.send(json.dumps({"type": "earcons", "have": {}}))
+        elif kind in ("audio_start", "earcon") and first is None:
+            first = time.monotonic()
+        elif kind == "error":
+            raise RuntimeError(control.get("message", "hub error"))
+        elif kind == "result":
+            done = time.monotonic()
+            turn = {
+                "upload": (released - pressed) * 1000,
+                "first_reply": ((first or done) - released) * 1000,
+                "reply_total": (done - released) * 1000,
+                "reply_bytes": size,
+                "stages": {name: ms for name, ms in (control.get("timings") or {}).items()
+                           if isinstance(ms, (int, float))},
+            }
+            if "processing_time" in control:
+                turn["processing"] = float(control["processing_time"]) * 1000
+            return turn
+
+
+# ============================================================
+# VIRTUAL SATELLITES
+# ============================================================
+
+async def satellite_run(index: int, transport: str, recordings: list, results: list,
+                        deadline: Optional[float], args) -> None:
+    satellite = f"{args.prefix}-{index:03d}"
+    rng = random.Random(args.seed * 1000 + index)
+    hub = args.hub.rstrip("/")
+    headers = {"X-Satellite-ID": satellite, "X-Playback-Rates": args.playback_rates}
+    socket = None
+
+    await asyncio.sleep(rng.uniform(0, args.ramp))   # Satellites don't all start at once
+    async with httpx.AsyncClient(timeout=args.timeout) as client:
+        try:
+            for turn_number in range(args.turns or sys.maxsize):
+                if deadline is not None and time.monotonic() >= deadline:
+                    break
+                if turn_number:
+                    await asyncio.sleep(rng.expovariate(1 / args.think) if args.think > 0 else 0)
+
+                recording = rng.choice(recordings)
+                turn_id = f"{satellite}-{turn_number}"
+                started = time.time()
+                try:
+                    if transport == "http":
+                        turn = await http_turn(client, hub, satellite, turn_id, recording, args)
+                    else:
+                        if socket is None:
+                            url = hub.replace("http", "ws", 1) + "/ws/voice"
+                            socket = await ws_connect(url, headers)
+                        turn = await ws_turn(socket, turn_id, recording, args)
+                    turn["ok"] = True
+                except Exception as e:
+                    turn = {"ok": False, "error": f"{type(e).__name__}: {e}"}
+                    if socket is not None:
+                        await socket.close()
+                        socket = None   # Reconnect for the next turn
+                turn.update(satellite=satellite, transport=transport, recording=recording["name"],
+                            started=started)
+                results.append(turn)
+                status = (f"{turn['first_reply']:.0f} ms to first reply" if turn["ok"]
+                          else f"FAILED ({turn['error']})")
+                print(f"[{satellite}] {transport} turn {turn_number + 1}: {status}", flush=True)
+        finally:
+            if socket is not None:
+                await socket.close()
+
+
+# ============================================================
+# REPORT
+# ============================================================
+
+def percentile(values: list, fraction: float) -> float:
+    """Nearest-rank percentile of a sorted list (as services/telemetry.py)."""
+    index = max(0, min(len(values) - 1, round(fraction * len(values) + 0.5) - 1))
+    return values[index]
+
+
+def summarize(turns: list) -> dict:
+    samples: dict = {}
+    counts: dict = {}
+    for turn in turns:
+        if not turn["ok"]:
+            continue
+        for name in ("upload", "first_reply", "reply_total", "processing"):
+            if name in turn:
+                samples.setdefault(name, []).append(turn[name])
+        for name, value in turn["stages"].items():
+            if name in COUNT_STAGES:
+                counts[f"hub.{name}"] = counts.get(f"hub.{name}", 0) + value
+            else:
+                samples.setdefault(f"hub.{name}", []).append(value)
+
+    metrics = {}
+    for name, values in samples.items():
+        values.sort()
+        metrics[name] = {
+            "count": len(values),
+            "p50": round(percentile(values, 0.50), 1),
+            "p95": round(percentile(values, 0.95), 1),
+            "p99": round(percentile(values, 0.99), 1),
+            "max": round(values[-1], 1),
+        }
+    return {
+        "turns": len(turns),
+        "errors": sum(1 for turn in turns if not turn["ok"]),
+        "metrics": metrics,
+        "counts": {name: round(total, 1) for name, total in sorted(counts.items())},
+    }
+
+
+def print_report(report: dict) -> None:
+    print(f"\n{report['satellites']} satellites, {report['elapsed_s']:.0f} s, "
+          f"{report['turns_per_min']:.1f} turns/min")
+    for transport, summary in report["transports"].items():
+        print(f"\n{transport}: {summary['turns']} turns, {summary['errors']} errors")
+        print(f"  {'metric (ms)':<28}{'count':>7}{'p50':>10}{'p95':>10}{'p99':>10}{'max':>10}")
+        order = ["upload", "first_reply", "reply_total", "processing"]
+        names = [n for n in order if n in summary["metrics"]] + \
+                sorted(n for n in summary["metrics"] if n not in order)
+        for name in names:
+            m = summary["metrics"][name]
+            print(f"  {name:<28}{m['count']:>7}{m['p50']:>10.1f}{m['p95']:>10.1f}{m['p99']:>10.1f}{m['max']:>10.1f}")
+        for name, total in summary["counts"].items():
+            print(f"  {name:<28}{total:>7g} in total")
+
+
+async def main() -> int:
+    parser = argparse.ArgumentParser(description="Simulate many satellites against a hub.")
+    parser.add_argument("--hub", default="http://localhost:8000", help="hub base URL")
+    parser.add_argument("--satellites", type=int, default=4, help="concurrent virtual satellites")
+    parser.add_argument("--transport", choices=("http", "websocket", "mixed"), default="http",
+                        help="mixed alternates satellites between the two")
+    parser.add_argument("--turns", type=int, default=5, help="turns per satellite (0: until --duration)")
+    parser.add_argument("--duration", type=float, default=0, help="stop starting turns after this many seconds")
+    parser.add_argument("--think", type=float, default=10.0,
+                        help="mean seconds between a reply and the next press (exponential)")
+    parser.add_argument("--ramp", type=float, default=5.0, help="spread satellite start over this many seconds")
+    parser.add_argument("--audio-dir", type=Path, default=Path("received_audio"), help="recordings to replay")
+    parser.add_argument("--max-recordings", type=int, default=200)
+    parser.add_argument("--no-realtime", dest="realtime", action="store_false",
+                        help="upload as fast as possible instead of at speaking pace")
+    parser.add_argument("--playback-rates", default="16000,22050,24000", help="X-Playback-Rates to send")
+    parser.add_argument("--timeout", type=float, default=60.0, help="seconds to wait for a reply")
+    parser.add_argument("--prefix", default="load", help="satellite ID prefix")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--json", type=Path, help="write the report and every turn to this file")
+    args = parser.parse_args()
+
+    if not args.turns and not args.duration:
+        parser.error("--turns 0 needs --duration")
+    recordings = load_recordings(args.audio_dir, args.max_recordings)
+    if not recordings:
+        print(f"No PCM or IMA-ADPCM recordings under {args.audio_dir}", file=sys.stderr)
+        return 1
+    print(f"Replaying {len(recordings)} recordings as {args.satellites} satellites ({args.transport})")
+
+    results: list = []
+    started = time.monotonic()
+    deadline = started + args.duration if args.duration else None
+    transports = ["http", "websocket"] if args.transport == "mixed" else [args.transport]
+    await asyncio.gather(*(
+        satellite_run(i, transports[i % len(transports)], recordings, results, deadline, args)
+        for i in range(args.satellites)
+    ))
+    elapsed = time.monotonic() - started
+
+    report = {
+        "hub": args.hub,
+        "satellites": args.satellites,
+        "elapsed_s": round(elapsed, 1),
+        "turns_per_min": len(results) / elapsed * 60 if elapsed else 0,
+        "transports": {t: summarize([r for r in results if r["transport"] == t]) for t in transports},
+    }
+    print_report(report)
+    if args.json:
+        args.json.write_text(json.dumps({**report, "turns": results}, indent=2))
+        print(f"\nWrote {args.json}")
+    return 0 if all(r["ok"] for r in results) else 2
+
+
+if __name__ == "__main__":
+    sys.exit(asyncio.run(main()))